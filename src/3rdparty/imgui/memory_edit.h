@@ -10,6 +10,11 @@ struct MemoryEditor
     char    DataInput[32];
     char    AddrInput[32];
 
+    // Optional accessors for memory that is not a contiguous array
+    void*   UserData;
+    unsigned char (*ReadFn)(void* user_data, size_t off);
+    void    (*WriteFn)(void* user_data, size_t off, unsigned char d);
+
     MemoryEditor()
     {
         Open = true;
@@ -19,6 +24,20 @@ struct MemoryEditor
         strcpy(DataInput, "");
         strcpy(AddrInput, "");
         AllowEdits = true;
+        UserData = NULL;
+        ReadFn = NULL;
+        WriteFn = NULL;
+    }
+
+    unsigned char ReadByte(unsigned char* mem_data, size_t off)
+    {
+        return ReadFn ? ReadFn(UserData, off) : mem_data[off];
+    }
+
+    void WriteByte(unsigned char* mem_data, size_t off, unsigned char d)
+    {
+        if (WriteFn) WriteFn(UserData, off, d);
+        else mem_data[off] = d;
     }
 
     void Draw(const char* title, unsigned char* mem_data, int mem_size, size_t base_display_addr = 0)
@@ -99,7 +118,7 @@ struct MemoryEditor
                         {
                             ImGui::SetKeyboardFocusHere();
                             sprintf(AddrInput, "%0*X", addr_digits_count, base_display_addr+addr);
-                            sprintf(DataInput, "%02X", mem_data[addr]);
+                            sprintf(DataInput, "%02X", ReadByte(mem_data, addr));
                         }
                         ImGui::PushItemWidth(ImGui::CalcTextSize("FF").x);
                         ImGuiInputTextFlags flags = ImGuiInputTextFlags_CharsHexadecimal|ImGuiInputTextFlags_EnterReturnsTrue|ImGuiInputTextFlags_AutoSelectAll|ImGuiInputTextFlags_NoHorizontalScroll|ImGuiInputTextFlags_AlwaysInsertMode|ImGuiInputTextFlags_CallbackAlways;
@@ -115,13 +134,13 @@ struct MemoryEditor
                         {
                             int data;
                             if (sscanf(DataInput, "%X", &data) == 1)
-                                mem_data[addr] = (unsigned char)data;
+                                WriteByte(mem_data, addr, (unsigned char)data);
                         }
                         ImGui::PopID();
                     }
                     else
                     {
-                        ImGui::Text("%02X ", mem_data[addr]);
+                        ImGui::Text("%02X ", ReadByte(mem_data, addr));
                         if (AllowEdits && ImGui::IsItemHovered() && ImGui::IsMouseClicked(0))
                         {
                             DataEditingTakeFocus = true;
@@ -144,7 +163,7 @@ struct MemoryEditor
                 for (int n = 0; n < Rows && addr < mem_size; n++, addr++)
                 {
                     if (n > 0) ImGui::SameLine();
-                    int c = mem_data[addr];
+                    int c = ReadByte(mem_data, addr);
                     ImGui::Text("%c", (c >= 32 && c < 128) ? c : '.');
                 }
             }
@@ -0,0 +1,107 @@
+#include "audio.h"
+
+#include <iostream>
+#include <algorithm>
+
+AudioOutput::AudioOutput()
+    : m_device(0),
+      m_sampleRate(AUDIO_SAMPLE_RATE),
+      m_lastSample(0),
+      m_underruns(0),
+      m_dropped(0)
+{}
+
+AudioOutput::~AudioOutput()
+{
+    close();
+}
+
+bool AudioOutput::open()
+{
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0)
+    {
+        std::cerr << "Failed to initialize audio subsystem: " << SDL_GetError() << std::endl;
+        return false;
+    }
+
+    SDL_AudioSpec want = {};
+    SDL_AudioSpec have;
+    want.freq = AUDIO_SAMPLE_RATE;
+    want.format = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples = AUDIO_DEVICE_SAMPLES;
+    want.callback = &AudioOutput::callback;
+    want.userdata = this;
+    m_device = SDL_OpenAudioDevice(NULL, 0, &want, &have, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+    if (m_device == 0)
+    {
+        std::cerr << "Failed to open audio device: " << SDL_GetError() << std::endl;
+        SDL_QuitSubSystem(SDL_INIT_AUDIO);
+        return false;
+    }
+    m_sampleRate = have.freq;
+    SDL_PauseAudioDevice(m_device, 0);
+    return true;
+}
+
+void AudioOutput::close()
+{
+    if (m_device == 0) { return; }
+    SDL_CloseAudioDevice(m_device);
+    SDL_QuitSubSystem(SDL_INIT_AUDIO);
+    m_device = 0;
+}
+
+bool AudioOutput::isOpen()
+{
+    return m_device != 0;
+}
+
+int AudioOutput::getSampleRate()
+{
+    return m_sampleRate;
+}
+
+void AudioOutput::push(const int16_t* samples, size_t count)
+{
+    size_t queued = m_ring.size();
+    size_t room = (queued < AUDIO_MAX_QUEUED) ? AUDIO_MAX_QUEUED - queued : 0;
+    size_t pushed = m_ring.push(samples, std::min(count, room));
+    m_dropped += (int)(count - pushed);
+}
+
+size_t AudioOutput::getQueued()
+{
+    return m_ring.size();
+}
+
+int AudioOutput::getUnderruns()
+{
+    return m_underruns;
+}
+
+int AudioOutput::getDroppedSamples()
+{
+    return m_dropped;
+}
+
+void SDLCALL AudioOutput::callback(void* userdata, Uint8* stream, int len)
+{
+    AudioOutput* audio = (AudioOutput*)userdata;
+    int16_t* out = (int16_t*)stream;
+    size_t count = len / sizeof(int16_t);
+
+    size_t popped = audio->m_ring.pop(out, count);
+    if (popped > 0)
+    {
+        audio->m_lastSample = out[popped - 1];
+    }
+    if (popped < count)
+    {
+        audio->m_underruns++;
+        for (size_t i = popped; i < count; i++)
+        {
+            out[i] = audio->m_lastSample;
+        }
+    }
+}
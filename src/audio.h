@@ -0,0 +1,45 @@
+#pragma once
+
+#include <SDL.h>
+
+#include "spscqueue.h"
+
+#include <stdint.h>
+#include <atomic>
+
+#define AUDIO_SAMPLE_RATE 48000         // Requested, the device may pick another rate
+#define AUDIO_DEVICE_SAMPLES 512        // Samples the device asks for at once
+#define AUDIO_RING_SIZE 16384
+#define AUDIO_MAX_QUEUED 4800           // Samples queued beyond this are dropped, bounds the latency
+
+// Plays mono 16-bit samples produced by the emulation thread. The SDL
+// audio callback pulls them from a lock-free ring, neither side waits
+class AudioOutput {
+    public:
+        AudioOutput();
+        ~AudioOutput();
+        AudioOutput(const AudioOutput&) = delete;
+        AudioOutput& operator=(const AudioOutput&) = delete;
+
+        bool open();
+        void close();
+        bool isOpen();
+        int getSampleRate();
+
+        // Emulation thread, queue samples for playback
+        void push(const int16_t* samples, size_t count);
+        // Samples waiting for the device
+        size_t getQueued();
+        // Times the device had to play silence because the ring was empty
+        int getUnderruns();
+        int getDroppedSamples();
+    private:
+        static void SDLCALL callback(void* userdata, Uint8* stream, int len);
+
+        SDL_AudioDeviceID m_device;
+        int m_sampleRate;
+        SPSCQueue<int16_t, AUDIO_RING_SIZE> m_ring;
+        int16_t m_lastSample;           // Audio thread, repeated on underruns to avoid clicks
+        std::atomic<int> m_underruns;
+        std::atomic<int> m_dropped;
+};
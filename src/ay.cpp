@@ -0,0 +1,321 @@
+#include "ay.h"
+
+#include <cstring>
+#include <climits>
+
+#ifndef ZXPP_SSE2
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define ZXPP_SSE2
+    #include <emmintrin.h>
+#endif
+#endif
+
+#define AY_MIXER 7
+#define AY_VOLUME_A 8
+#define AY_ENVELOPE_FINE 11
+#define AY_ENVELOPE_COARSE 12
+#define AY_ENVELOPE_SHAPE 13
+
+#define AY_SHAPE_HOLD 0x01
+#define AY_SHAPE_ALTERNATE 0x02
+#define AY_SHAPE_ATTACK 0x04
+#define AY_SHAPE_CONTINUE 0x08
+
+// Unused bits of the registers read back as zero
+static const uint8_t registerMasks[AY_REGISTERS] = {
+    0xFF, 0x0F, 0xFF, 0x0F, 0xFF, 0x0F, 0x1F, 0xFF,
+    0x1F, 0x1F, 0x1F, 0xFF, 0xFF, 0x0F, 0xFF, 0xFF
+};
+
+// The DAC is logarithmic, measured output of the 16 volume levels
+static const double volumeLevels[16] = {
+    0.0, 0.00999, 0.01445, 0.02106, 0.03070, 0.04555, 0.06450, 0.10736,
+    0.12659, 0.20499, 0.29221, 0.37284, 0.49253, 0.63532, 0.80558, 1.0
+};
+
+static int volumeAmplitude(int level)
+{
+    return (int)(volumeLevels[level] * AY_VOLUME + 0.5);
+}
+
+AY::AY()
+    : m_mixer(nullptr),
+      m_source(0),
+      m_enabled(false),
+      m_tStatesPerFrame(69888)
+{
+    m_writes.reserve(1024);
+    reset();
+}
+
+void AY::attach(AudioMixer* mixer)
+{
+    m_mixer = mixer;
+    m_source = mixer->addSource();
+}
+
+void AY::setMachineModel(const MachineModel& model)
+{
+    m_enabled = model.hasAY;
+    m_tStatesPerFrame = model.tStatesPerFrame;
+}
+
+bool AY::isEnabled()
+{
+    return m_enabled;
+}
+
+void AY::reset()
+{
+    memset(m_registers, 0, sizeof(m_registers));
+    memset(m_renderRegisters, 0, sizeof(m_renderRegisters));
+    m_selected = 0;
+    m_writes.clear();
+
+    m_nextTick = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        m_toneCount[i] = 0;
+        m_toneLast[i] = 0;
+        m_toneOutput[i] = 0;
+    }
+    m_toneLast[3] = INT_MAX;
+    m_toneOff = 0;
+    m_noiseOff = 0;
+    m_noiseCount = 0;
+    m_noiseShift = 1;
+    m_envelopeCount = 0;
+    m_envelopeStep = 0;
+    m_envelopeAttack = false;
+    m_envelopeHolding = false;
+    m_envelopeLevel = 15;
+    updateLevels();
+    m_level = m_levels[0];
+    if (m_mixer != nullptr)
+    {
+        m_mixer->setLevel(m_source, 0, m_level);
+    }
+}
+
+void AY::receiveData(uint8_t data, uint16_t port, int tState)
+{
+    // Decoded by A15 set and A1 reset, A14 tells 0xFFFD from 0xBFFD
+    if (!m_enabled || (port & 0x8002) != 0x8000) { return; }
+
+    if ((port & 0x4000) != 0)
+    {
+        m_selected = data & 0x0F;
+        return;
+    }
+
+    uint8_t value = data & registerMasks[m_selected];
+    m_registers[m_selected] = value;
+    m_writes.push_back({ tState, m_selected, value });
+}
+
+bool AY::sendData(uint8_t& out, uint16_t port, int tState)
+{
+    // Port 0xFFFD reads the selected register
+    if (!m_enabled || (port & 0xC002) != 0xC000) { return false; }
+
+    out = m_registers[m_selected];
+    return true;
+}
+
+void AY::saveState(std::vector<uint8_t>& out)
+{
+    out.insert(out.end(), m_registers, m_registers + AY_REGISTERS);
+    out.push_back(m_selected);
+}
+
+void AY::loadState(const uint8_t*& in)
+{
+    memcpy(m_registers, in, AY_REGISTERS);
+    in += AY_REGISTERS;
+    m_selected = *in++;
+    m_writes.clear();
+
+    // Only registers that differ reach the generators, restoring the state
+    // the generators already play (run-ahead) doesn't restart the envelope
+    for (int i = 0; i < AY_REGISTERS; i++)
+    {
+        if (m_registers[i] != m_renderRegisters[i])
+        {
+            applyRegister(i, m_registers[i]);
+        }
+    }
+}
+
+void AY::endFrame()
+{
+    if (m_enabled)
+    {
+        for (const AYWrite& write : m_writes)
+        {
+            render(write.tState);
+            applyRegister(write.reg, write.value);
+        }
+        render(m_tStatesPerFrame);
+        m_nextTick -= m_tStatesPerFrame;
+    }
+    m_writes.clear();
+}
+
+void AY::discardFrame()
+{
+    m_writes.clear();
+}
+
+uint8_t AY::getRegister(int reg)
+{
+    return m_registers[reg & 0x0F];
+}
+
+void AY::render(int tState)
+{
+    // Noise and envelope periods can't change during a run
+    int noisePeriod = (m_renderRegisters[6] == 0) ? 2 : m_renderRegisters[6] * 2;
+    int envelopePeriod = m_renderRegisters[AY_ENVELOPE_FINE] | (m_renderRegisters[AY_ENVELOPE_COARSE] << 8);
+    envelopePeriod = (envelopePeriod == 0) ? 2 : envelopePeriod * 2;
+
+#ifdef ZXPP_SSE2
+    // The three tone counters step together, one lane each
+    __m128i count = _mm_load_si128((const __m128i*)m_toneCount);
+    __m128i last = _mm_load_si128((const __m128i*)m_toneLast);
+    __m128i output = _mm_load_si128((const __m128i*)m_toneOutput);
+    const __m128i one = _mm_set1_epi32(1);
+#endif
+
+    while (m_nextTick < tState)
+    {
+#ifdef ZXPP_SSE2
+        count = _mm_add_epi32(count, one);
+        __m128i flip = _mm_cmpgt_epi32(count, last);
+        count = _mm_andnot_si128(flip, count);
+        output = _mm_xor_si128(output, flip);
+        int tone = _mm_movemask_ps(_mm_castsi128_ps(output)) & 7;
+#else
+        int tone = 0;
+        for (int i = 0; i < 3; i++)
+        {
+            if (++m_toneCount[i] > m_toneLast[i])
+            {
+                m_toneCount[i] = 0;
+                m_toneOutput[i] = ~m_toneOutput[i];
+            }
+            tone |= (m_toneOutput[i] & 1) << i;
+        }
+#endif
+
+        if (++m_noiseCount >= noisePeriod)
+        {
+            // 17-bit LFSR, taps at bits 0 and 3
+            m_noiseCount = 0;
+            m_noiseShift = (m_noiseShift >> 1) | (((m_noiseShift ^ (m_noiseShift >> 3)) & 1) << 16);
+        }
+        int noise = (m_noiseShift & 1) ? 7 : 0;
+
+        if (++m_envelopeCount >= envelopePeriod)
+        {
+            m_envelopeCount = 0;
+            stepEnvelope();
+        }
+
+        // A channel is high when its enabled sources are high
+        int on = (tone | m_toneOff) & (noise | m_noiseOff);
+        int level = m_levels[on];
+        if (level != m_level)
+        {
+            m_level = level;
+            m_mixer->setLevel(m_source, m_nextTick, level);
+        }
+        m_nextTick += AY_TICK_TSTATES;
+    }
+
+#ifdef ZXPP_SSE2
+    _mm_store_si128((__m128i*)m_toneCount, count);
+    _mm_store_si128((__m128i*)m_toneOutput, output);
+#endif
+}
+
+void AY::applyRegister(int reg, uint8_t value)
+{
+    m_renderRegisters[reg] = value;
+    switch (reg)
+    {
+        case 0: case 1: case 2: case 3: case 4: case 5:
+        {
+            int channel = reg / 2;
+            int period = m_renderRegisters[channel * 2] | (m_renderRegisters[channel * 2 + 1] << 8);
+            m_toneLast[channel] = (period == 0) ? 0 : period - 1;
+            break;
+        }
+        case AY_MIXER:
+            m_toneOff = value & 7;
+            m_noiseOff = (value >> 3) & 7;
+            break;
+        case AY_VOLUME_A: case AY_VOLUME_A + 1: case AY_VOLUME_A + 2:
+            updateLevels();
+            break;
+        case AY_ENVELOPE_SHAPE:
+            // Writing the shape restarts the envelope
+            m_envelopeCount = 0;
+            m_envelopeStep = 0;
+            m_envelopeAttack = (value & AY_SHAPE_ATTACK) != 0;
+            m_envelopeHolding = false;
+            m_envelopeLevel = m_envelopeAttack ? 0 : 15;
+            updateLevels();
+            break;
+    }
+}
+
+void AY::stepEnvelope()
+{
+    if (m_envelopeHolding) { return; }
+
+    if (++m_envelopeStep > 15)
+    {
+        uint8_t shape = m_renderRegisters[AY_ENVELOPE_SHAPE];
+        if ((shape & AY_SHAPE_CONTINUE) == 0)
+        {
+            // Shapes 0-7 end silent
+            m_envelopeAttack = false;
+            m_envelopeHolding = true;
+            m_envelopeStep = 15;
+        }
+        else if ((shape & AY_SHAPE_HOLD) != 0)
+        {
+            if ((shape & AY_SHAPE_ALTERNATE) != 0) { m_envelopeAttack = !m_envelopeAttack; }
+            m_envelopeHolding = true;
+            m_envelopeStep = 15;
+        }
+        else
+        {
+            if ((shape & AY_SHAPE_ALTERNATE) != 0) { m_envelopeAttack = !m_envelopeAttack; }
+            m_envelopeStep = 0;
+        }
+    }
+
+    int level = m_envelopeAttack ? m_envelopeStep : 15 - m_envelopeStep;
+    if (level != m_envelopeLevel)
+    {
+        m_envelopeLevel = level;
+        updateLevels();
+    }
+}
+
+void AY::updateLevels()
+{
+    int amplitudes[3];
+    for (int i = 0; i < 3; i++)
+    {
+        uint8_t volume = m_renderRegisters[AY_VOLUME_A + i];
+        amplitudes[i] = volumeAmplitude((volume & 0x10) ? m_envelopeLevel : (volume & 0x0F));
+    }
+    for (int on = 0; on < 8; on++)
+    {
+        m_levels[on] = ((on & 1) ? amplitudes[0] : 0) +
+                       ((on & 2) ? amplitudes[1] : 0) +
+                       ((on & 4) ? amplitudes[2] : 0);
+    }
+}
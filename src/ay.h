@@ -0,0 +1,82 @@
+#pragma once
+
+#include "devices.h"
+#include "machine.h"
+#include "mixer.h"
+
+#include <stdint.h>
+#include <vector>
+
+#define AY_REGISTERS 16
+#define AY_TICK_TSTATES 16              // Generators step every 8 AY clocks, the AY runs at half the CPU clock
+#define AY_VOLUME 7000                  // Amplitude of one channel at full volume
+
+struct AYWrite {
+    int tState;
+    uint8_t reg;
+    uint8_t value;
+};
+
+// AY-3-8912 sound chip of the 128K, register select on port 0xFFFD and data
+// on 0xBFFD. Writes are stamped with the T-state like the beeper edges. At
+// the end of the frame the tone, noise and envelope generators are stepped
+// at the chip's internal rate (AY clock / 8) and the changes of the mixed
+// output go to the audio mixer
+class AY : public IDevice {
+    public:
+        AY();
+
+        void attach(AudioMixer* mixer);
+        // The chip only answers on machines that have one
+        void setMachineModel(const MachineModel& model);
+        bool isEnabled();
+        // Power on state, all registers cleared
+        void reset();
+
+        virtual void receiveData(uint8_t data, uint16_t port, int tState) override;
+        virtual bool sendData(uint8_t& out, uint16_t port, int tState) override;
+        virtual void saveState(std::vector<uint8_t>& out) override;
+        virtual void loadState(const uint8_t*& in) override;
+
+        // Synthesize the frame that was just emulated into the mixer
+        void endFrame();
+        // Forget the writes of a frame that is not heard (run-ahead)
+        void discardFrame();
+
+        uint8_t getRegister(int reg);
+    private:
+        // Step the generators until the T-state
+        void render(int tState);
+        // Apply a register write to the generators
+        void applyRegister(int reg, uint8_t value);
+        void stepEnvelope();
+        void updateLevels();
+
+        AudioMixer* m_mixer;
+        int m_source;
+        bool m_enabled;
+        int m_tStatesPerFrame;
+
+        // As seen by the CPU
+        uint8_t m_registers[AY_REGISTERS];
+        uint8_t m_selected;
+        std::vector<AYWrite> m_writes;
+
+        // As applied to the generators
+        uint8_t m_renderRegisters[AY_REGISTERS];
+        int m_nextTick;                             // T-state of the next generator step
+        alignas(16) int32_t m_toneCount[4];         // Channels A, B, C and an unused lane
+        alignas(16) int32_t m_toneLast[4];          // Period - 1, the count at which the output flips
+        alignas(16) int32_t m_toneOutput[4];        // 0 or -1
+        int m_toneOff;                              // Mixer bits, a set bit disables tone/noise of a channel
+        int m_noiseOff;
+        int m_noiseCount;
+        uint32_t m_noiseShift;                      // 17-bit LFSR
+        int m_envelopeCount;
+        int m_envelopeStep;
+        bool m_envelopeAttack;
+        bool m_envelopeHolding;
+        int m_envelopeLevel;
+        int m_levels[8];                            // Output for each combination of channels on
+        int m_level;
+};
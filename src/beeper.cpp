@@ -0,0 +1,63 @@
+#include "beeper.h"
+
+#define BEEPER_EAR 0x10
+#define BEEPER_MIC 0x08
+
+static int beeperAmplitude(uint8_t bits)
+{
+    return ((bits & BEEPER_EAR) ? BEEPER_VOLUME : 0) + ((bits & BEEPER_MIC) ? BEEPER_MIC_VOLUME : 0);
+}
+
+Beeper::Beeper()
+    : m_mixer(nullptr),
+      m_source(0),
+      m_bits(0)
+{
+    m_edges.reserve(1024);
+}
+
+void Beeper::attach(AudioMixer* mixer)
+{
+    m_mixer = mixer;
+    m_source = mixer->addSource();
+}
+
+void Beeper::receiveData(uint8_t data, uint16_t port, int tState)
+{
+    if ((port & 0x01) != 0) { return; }
+
+    uint8_t bits = data & (BEEPER_EAR | BEEPER_MIC);
+    if (bits == m_bits) { return; }
+    m_bits = bits;
+    m_edges.push_back({ tState, beeperAmplitude(bits) });
+}
+
+bool Beeper::sendData(uint8_t& out, uint16_t port, int tState)
+{
+    return false;
+}
+
+void Beeper::saveState(std::vector<uint8_t>& out)
+{
+    out.push_back(m_bits);
+}
+
+void Beeper::loadState(const uint8_t*& in)
+{
+    // The mixer moves to the restored level with the next edge
+    m_bits = *in++;
+}
+
+void Beeper::endFrame()
+{
+    for (const BeeperEdge& edge : m_edges)
+    {
+        m_mixer->setLevel(m_source, edge.tState, edge.amplitude);
+    }
+    m_edges.clear();
+}
+
+void Beeper::discardFrame()
+{
+    m_edges.clear();
+}
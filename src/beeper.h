@@ -0,0 +1,40 @@
+#pragma once
+
+#include "devices.h"
+#include "mixer.h"
+
+#include <stdint.h>
+#include <vector>
+
+#define BEEPER_VOLUME 8192              // Amplitude of the EAR bit
+#define BEEPER_MIC_VOLUME 1024          // MIC bit, only audible faintly through the speaker
+
+struct BeeperEdge {
+    int tState;
+    int amplitude;
+};
+
+// Speaker on bits 4 (EAR) and 3 (MIC) of port 0xFE. Writes are kept as
+// edges stamped with the T-state of the frame and turned into samples at
+// the end of the frame
+class Beeper : public IDevice {
+    public:
+        Beeper();
+
+        void attach(AudioMixer* mixer);
+
+        virtual void receiveData(uint8_t data, uint16_t port, int tState) override;
+        virtual bool sendData(uint8_t& out, uint16_t port, int tState) override;
+        virtual void saveState(std::vector<uint8_t>& out) override;
+        virtual void loadState(const uint8_t*& in) override;
+
+        // Pass the edges of the frame that was just emulated to the mixer
+        void endFrame();
+        // Forget the edges of a frame that is not heard (run-ahead)
+        void discardFrame();
+    private:
+        AudioMixer* m_mixer;
+        int m_source;
+        uint8_t m_bits;                 // Bits 3 and 4 of the last write
+        std::vector<BeeperEdge> m_edges;
+};
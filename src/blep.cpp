@@ -0,0 +1,142 @@
+#include "blep.h"
+
+#include <cmath>
+#include <algorithm>
+
+#ifndef ZXPP_SSE2
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define ZXPP_SSE2
+    #include <emmintrin.h>
+#endif
+#endif
+
+#define BLEP_CUTOFF 0.45                // Of the sample rate, just below Nyquist
+#define BLEP_HIGHPASS 65470             // DC blocker pole, 0.999 in 16.16
+
+static const double PI = 3.14159265358979323846;
+
+BlepBuffer::BlepBuffer()
+    : m_sampleRate(44100),
+      m_factor(0),
+      m_offset(0),
+      m_amplitude(0),
+      m_integrator(0),
+      m_highpassIn(0),
+      m_highpassOut(0)
+{
+    buildKernel();
+    setRates(3500000.0, m_sampleRate);
+}
+
+void BlepBuffer::setRates(double clockRate, int sampleRate)
+{
+    m_sampleRate = sampleRate;
+    m_factor = (uint64_t)(sampleRate / clockRate * (double)(1ULL << BLEP_TIME_BITS) + 0.5);
+    m_buffer.reserve((size_t)(sampleRate * BLEP_RESERVE_TIME) + BLEP_HALF_WIDTH * 2);
+}
+
+int BlepBuffer::getSampleRate()
+{
+    return m_sampleRate;
+}
+
+void BlepBuffer::buildKernel()
+{
+    for (int phase = 0; phase < BLEP_PHASES; phase++)
+    {
+        // The step lies frac samples after the first tap and its center
+        // BLEP_HALF_WIDTH - 0.5 taps later, that is the delay of the output
+        double frac = (double)phase / BLEP_PHASES;
+        double taps[BLEP_HALF_WIDTH * 2];
+        double sum = 0.0;
+        for (int k = 0; k < BLEP_HALF_WIDTH * 2; k++)
+        {
+            double t = k - frac - BLEP_HALF_WIDTH + 0.5;
+            double x = 2.0 * BLEP_CUTOFF * t;
+            double sinc = (x == 0.0) ? 1.0 : std::sin(PI * x) / (PI * x);
+            double w = t / BLEP_HALF_WIDTH;
+            double blackman = 0.42 + 0.5 * std::cos(PI * w) + 0.08 * std::cos(2.0 * PI * w);
+            taps[k] = sinc * std::max(blackman, 0.0);
+            sum += taps[k];
+        }
+
+        // Every phase has to add up to exactly one step, rounding errors
+        // go to the center tap
+        int total = 0;
+        for (int k = 0; k < BLEP_HALF_WIDTH * 2; k++)
+        {
+            m_kernel[phase][k] = (int16_t)std::lround(taps[k] / sum * (1 << BLEP_KERNEL_BITS));
+            total += m_kernel[phase][k];
+        }
+        m_kernel[phase][BLEP_HALF_WIDTH] += (int16_t)((1 << BLEP_KERNEL_BITS) - total);
+    }
+}
+
+void BlepBuffer::addStep(int tState, int delta)
+{
+    if (delta == 0) { return; }
+    m_amplitude += delta;
+
+    uint64_t position = m_offset + (uint64_t)std::max(tState, 0) * m_factor;
+    size_t index = (size_t)(position >> BLEP_TIME_BITS);
+    int phase = (int)(position >> (BLEP_TIME_BITS - BLEP_PHASE_BITS)) & (BLEP_PHASES - 1);
+    if (m_buffer.size() < index + BLEP_HALF_WIDTH * 2)
+    {
+        m_buffer.resize(index + BLEP_HALF_WIDTH * 2, 0);
+    }
+
+    int32_t* out = &m_buffer[index];
+    const int16_t* kernel = m_kernel[phase];
+#ifdef ZXPP_SSE2
+    if (delta >= -32768 && delta <= 32767)
+    {
+        // 16x16 bit products, the low and high halves interleave to 32 bits
+        __m128i d = _mm_set1_epi16((short)delta);
+        for (int k = 0; k < BLEP_HALF_WIDTH * 2; k += 8)
+        {
+            __m128i taps = _mm_load_si128((const __m128i*)&kernel[k]);
+            __m128i lo = _mm_mullo_epi16(taps, d);
+            __m128i hi = _mm_mulhi_epi16(taps, d);
+            __m128i* dst = (__m128i*)&out[k];
+            _mm_storeu_si128(dst, _mm_add_epi32(_mm_loadu_si128(dst), _mm_unpacklo_epi16(lo, hi)));
+            _mm_storeu_si128(dst + 1, _mm_add_epi32(_mm_loadu_si128(dst + 1), _mm_unpackhi_epi16(lo, hi)));
+        }
+        return;
+    }
+#endif
+    for (int k = 0; k < BLEP_HALF_WIDTH * 2; k++)
+    {
+        out[k] += delta * kernel[k];
+    }
+}
+
+void BlepBuffer::endFrame(int tStates, std::vector<int16_t>& out)
+{
+    uint64_t end = m_offset + (uint64_t)tStates * m_factor;
+    size_t count = (size_t)(end >> BLEP_TIME_BITS);
+    if (m_buffer.size() < count + BLEP_HALF_WIDTH * 2)
+    {
+        m_buffer.resize(count + BLEP_HALF_WIDTH * 2, 0);
+    }
+
+    // Later steps start at or after sample count, the ones before are final
+    for (size_t i = 0; i < count; i++)
+    {
+        m_integrator += m_buffer[i];
+        int32_t x = m_integrator >> BLEP_KERNEL_BITS;
+        m_highpassOut = x - m_highpassIn + (int32_t)(((int64_t)m_highpassOut * BLEP_HIGHPASS) >> 16);
+        m_highpassIn = x;
+        out.push_back((int16_t)std::min(std::max(m_highpassOut, -32768), 32767));
+    }
+
+    std::copy(m_buffer.begin() + count, m_buffer.end(), m_buffer.begin());
+    std::fill(m_buffer.end() - count, m_buffer.end(), 0);
+    m_offset = end - ((uint64_t)count << BLEP_TIME_BITS);
+}
+
+void BlepBuffer::clear()
+{
+    std::fill(m_buffer.begin(), m_buffer.end(), 0);
+    m_offset &= ((1ULL << BLEP_TIME_BITS) - 1);
+    m_integrator = m_amplitude << BLEP_KERNEL_BITS;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#define BLEP_HALF_WIDTH 8           // Kernel taps on each side of a step
+#define BLEP_PHASE_BITS 5           // 32 sub-sample positions of a step
+#define BLEP_PHASES (1 << BLEP_PHASE_BITS)
+#define BLEP_KERNEL_BITS 12         // Each kernel phase sums to 1 << BLEP_KERNEL_BITS
+#define BLEP_TIME_BITS 24           // Fraction bits of sample positions
+#define BLEP_RESERVE_TIME 0.1       // Seconds of samples the buffer holds without reallocating
+
+// Turns a signal given as level changes at T-states into samples. Every
+// change adds a band-limited step (a windowed sinc integrated by the
+// output), so square waves don't alias. Work is proportional to the number
+// of changes and samples, nothing is done per T-state
+class BlepBuffer {
+    public:
+        BlepBuffer();
+
+        // Input clock (T-states per second) and output sample rate
+        void setRates(double clockRate, int sampleRate);
+        int getSampleRate();
+
+        // Add a step of delta at a T-state of the current frame, in any
+        // order. T-states past the frame end are allowed, for instructions
+        // that run over it
+        void addStep(int tState, int delta);
+        // Close a frame tStates long and append the finished samples to out
+        void endFrame(int tStates, std::vector<int16_t>& out);
+
+        // Drop everything not output yet
+        void clear();
+    private:
+        void buildKernel();
+
+        int m_sampleRate;
+        uint64_t m_factor;              // Samples per T-state, BLEP_TIME_BITS fraction
+        uint64_t m_offset;              // Position of the frame start in the buffer
+
+        std::vector<int32_t> m_buffer;  // Step derivatives, integrated on output
+        int m_amplitude;                // Sum of all steps
+        int32_t m_integrator;
+        int32_t m_highpassIn;           // DC blocker, the beeper is not centered
+        int32_t m_highpassOut;
+
+        alignas(16) int16_t m_kernel[BLEP_PHASES][BLEP_HALF_WIDTH * 2];
+};
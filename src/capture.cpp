@@ -0,0 +1,197 @@
+#include "capture.h"
+#include "png.h"
+#include "ula.h"
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+FrameCapture::FrameCapture(const CaptureSettings& settings)
+    : m_settings(settings),
+      m_rawFile(nullptr),
+      m_frame(0),
+      m_sequence(0),
+      m_paused(false),
+      m_requested(false),
+      m_captured(0),
+      m_failed(0),
+      m_busy(0),
+      m_nextWrite(0),
+      m_quit(false)
+{
+    if (m_settings.format == CaptureFormat::RAW)
+    {
+        if (m_settings.output == "-")
+        {
+#ifdef _WIN32
+            _setmode(_fileno(stdout), _O_BINARY);
+#endif
+            m_rawFile = stdout;
+        }
+        else
+        {
+            m_rawFile = fopen(m_settings.output.c_str(), "wb");
+            if (m_rawFile == nullptr)
+            {
+                std::cerr << "Failed to open capture output " << m_settings.output << std::endl;
+            }
+        }
+    }
+
+    int workers = m_settings.workers;
+    if (workers <= 0)
+    {
+        // Leave a core to the emulation
+        workers = std::max(1, (int)std::thread::hardware_concurrency() - 1);
+    }
+    for (int i = 0; i < workers; i++)
+    {
+        m_workers.push_back(std::thread(&FrameCapture::run, this));
+    }
+}
+
+FrameCapture::~FrameCapture()
+{
+    flush();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_wake.notify_all();
+    for (std::thread& worker : m_workers)
+    {
+        worker.join();
+    }
+    if (m_rawFile != nullptr && m_rawFile != stdout)
+    {
+        fclose(m_rawFile);
+    }
+}
+
+void FrameCapture::request()
+{
+    m_requested = true;
+}
+
+bool FrameCapture::nextFrame(bool emulated)
+{
+    bool requested = m_requested.exchange(false);
+    m_paused = !emulated;
+    if (!emulated)
+    {
+        return requested;
+    }
+    int frame = m_frame++;
+    return requested || (m_settings.interval > 0 && frame % m_settings.interval == 0);
+}
+
+void FrameCapture::capture(const uint32_t* pixels)
+{
+    Job job;
+    job.sequence = m_sequence++;
+    job.frame = std::max(m_frame - 1, 0);
+    job.paused = m_paused;
+    job.pixels.assign(pixels, pixels + FRAME_WIDTH * FRAME_HEIGHT);
+
+    // In batch runs the emulation is usually faster than the encoding,
+    // wait instead of queueing frames without limit
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_space.wait(lock, [this] { return m_jobs.size() < CAPTURE_QUEUE_SIZE; });
+    m_jobs.push_back(std::move(job));
+    m_wake.notify_one();
+}
+
+void FrameCapture::flush()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_written.wait(lock, [this] { return m_jobs.empty() && m_busy == 0; });
+    if (m_rawFile != nullptr)
+    {
+        fflush(m_rawFile);
+    }
+}
+
+int FrameCapture::getCapturedFrames()
+{
+    return m_captured;
+}
+
+int FrameCapture::getFailedFrames()
+{
+    return m_failed;
+}
+
+void FrameCapture::run()
+{
+    // Buffers are reused for all frames handled by this worker
+    std::vector<uint8_t> rgb;
+    std::vector<uint8_t> encoded;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        m_wake.wait(lock, [this] { return m_quit || !m_jobs.empty(); });
+        if (m_jobs.empty()) { return; }
+
+        Job job = std::move(m_jobs.front());
+        m_jobs.pop_front();
+        m_busy++;
+        m_space.notify_one();
+        lock.unlock();
+
+        write(job, rgb, encoded);
+
+        lock.lock();
+        m_busy--;
+        m_written.notify_all();
+    }
+}
+
+void FrameCapture::write(const Job& job, std::vector<uint8_t>& rgb, std::vector<uint8_t>& encoded)
+{
+    // Pixels are 0xAARRGGBB
+    rgb.resize(job.pixels.size() * 3);
+    uint8_t* out = rgb.data();
+    for (uint32_t pixel : job.pixels)
+    {
+        *out++ = (uint8_t)(pixel >> 16);
+        *out++ = (uint8_t)(pixel >> 8);
+        *out++ = (uint8_t)pixel;
+    }
+
+    bool ok;
+    if (m_settings.format == CaptureFormat::PNG)
+    {
+        encodePNG(rgb.data(), FRAME_WIDTH, FRAME_HEIGHT, encoded);
+
+        std::stringstream filename;
+        filename << m_settings.output << std::setw(6) << std::setfill('0') << job.frame;
+        if (job.paused)
+        {
+            // Every shot of a paused machine is kept
+            filename << "_" << job.sequence;
+        }
+        filename << ".png";
+        FILE* file = fopen(filename.str().c_str(), "wb");
+        ok = (file != nullptr) && fwrite(encoded.data(), 1, encoded.size(), file) == encoded.size();
+        if (file != nullptr) { ok = (fclose(file) == 0) && ok; }
+    }
+    else
+    {
+        // Raw frames have to stay in order, wait for the previous ones
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_written.wait(lock, [this, &job] { return m_nextWrite == job.sequence; });
+        ok = (m_rawFile != nullptr) && fwrite(rgb.data(), 1, rgb.size(), m_rawFile) == rgb.size();
+        m_nextWrite++;
+        m_written.notify_all();
+    }
+
+    if (ok) { m_captured++; }
+    else { m_failed++; }
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdint.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+#define CAPTURE_QUEUE_SIZE 32           // Frames waiting for a worker before capture() blocks
+
+enum class CaptureFormat {
+    PNG,        // One file per frame, <output><frame number>.png, frames shot
+                // while paused <output><frame number>_<capture number>.png
+    RAW         // RGB24 frames appended to one file, "-" is stdout
+};
+
+struct CaptureSettings {
+    CaptureFormat format;
+    std::string output;
+    int interval;               // Capture every Nth frame, 0 only on request
+    int workers;                // 0 picks by the number of cores
+
+    CaptureSettings() : format(CaptureFormat::PNG), output("screenshot_"), interval(0), workers(0) {}
+};
+
+// Writes finished frames without any GL context. Frames are converted and
+// encoded by a pool of worker threads, the emulation only copies the pixels
+class FrameCapture {
+    public:
+        FrameCapture(const CaptureSettings& settings);
+        // Waits until all captured frames are written
+        ~FrameCapture();
+        FrameCapture(const FrameCapture&) = delete;
+        FrameCapture& operator=(const FrameCapture&) = delete;
+
+        // Capture the next frame regardless of the interval, thread safe
+        void request();
+
+        // Called once per frame, returns if the frame should be captured.
+        // Frames shown while the machine is paused (emulated is false) are
+        // only captured on request and do not count towards the interval
+        bool nextFrame(bool emulated);
+        // Queue FRAME_WIDTH x FRAME_HEIGHT pixels of the ULA frame
+        void capture(const uint32_t* pixels);
+
+        // Block until the queue is empty and everything is written
+        void flush();
+
+        int getCapturedFrames();
+        int getFailedFrames();
+    private:
+        struct Job {
+            int sequence;           // Order of the frames in a raw stream
+            int frame;
+            bool paused;            // Frame shown again, the frame number isn't unique
+            std::vector<uint32_t> pixels;
+        };
+
+        void run();
+        void write(const Job& job, std::vector<uint8_t>& rgb, std::vector<uint8_t>& encoded);
+
+        CaptureSettings m_settings;
+        FILE* m_rawFile;
+
+        // Used by the emulation thread only
+        int m_frame;
+        int m_sequence;
+        bool m_paused;                      // Last frame passed to nextFrame wasn't emulated
+
+        std::atomic<bool> m_requested;
+        std::atomic<int> m_captured;
+        std::atomic<int> m_failed;
+
+        std::deque<Job> m_jobs;
+        int m_busy;                         // Jobs taken by workers and not written yet
+        int m_nextWrite;                    // Sequence of the next raw frame to write
+        bool m_quit;
+        std::mutex m_mutex;
+        std::condition_variable m_wake;     // New job or quit
+        std::condition_variable m_space;    // Job taken from a full queue
+        std::condition_variable m_written;  // Frame written
+        std::vector<std::thread> m_workers;
+};
@@ -94,9 +94,18 @@ Debugger::Debugger()
     : m_lastIndex(0),
       m_breakExecution(false),
       m_breakNextFrame(false),
+      m_memory(nullptr),
+      m_watchPorts(false),
       selectedTrace(-1)
 {}
 
+void Debugger::setMemory(SpectrumMemory* memory)
+{
+    m_memory = memory;
+    m_memory->setWatcher(this);
+    updateWatchpoints();
+}
+
 int Debugger::addBreakpoint(Breakpoint breakpoint)
 {
     m_breakpoints.emplace(++m_lastIndex, breakpoint);
@@ -118,6 +127,114 @@ std::map<int, Breakpoint>* Debugger::getBreakpoints()
     return &m_breakpoints;
 }
 
+int Debugger::addWatchpoint(Watchpoint watchpoint)
+{
+    m_watchpoints.emplace(++m_lastIndex, watchpoint);
+    updateWatchpoints();
+    return m_lastIndex;
+}
+
+void Debugger::removeWatchpoint(int index)
+{
+    m_watchpoints.erase(index);
+    updateWatchpoints();
+}
+
+std::map<int, Watchpoint>* Debugger::getWatchpoints()
+{
+    return &m_watchpoints;
+}
+
+void Debugger::updateWatchpoints()
+{
+    uint8_t flags[ADDRESS_SPACE_PAGES] = {};
+    m_watchPorts = false;
+    for (auto it = m_watchpoints.begin(); it != m_watchpoints.end(); ++it)
+    {
+        Watchpoint& wp = it->second;
+        if (!wp.enabled) { continue; }
+        if (wp.type == WatchpointType::IN || wp.type == WatchpointType::OUT)
+        {
+            m_watchPorts = true;
+            continue;
+        }
+        uint8_t flag = (wp.type == WatchpointType::READ) ? PAGE_FLAG_WATCH_READ : PAGE_FLAG_WATCH_WRITE;
+        for (int page = wp.start >> MEMORY_PAGE_SHIFT; page <= (wp.end >> MEMORY_PAGE_SHIFT); page++)
+        {
+            flags[page] |= flag;
+        }
+    }
+
+    if (m_memory == nullptr) { return; }
+    for (int page = 0; page < ADDRESS_SPACE_PAGES; page++)
+    {
+        m_memory->setWatchFlags(page, flags[page]);
+    }
+}
+
+std::vector<WatchpointHit>* Debugger::getWatchpointHits()
+{
+    return &m_watchpointHits;
+}
+
+void Debugger::memoryRead(uint16_t address, uint8_t value)
+{
+    watchpointHit(WatchpointType::READ, address, value, value);
+}
+
+void Debugger::memoryWritten(uint16_t address, uint8_t oldValue, uint8_t newValue)
+{
+    watchpointHit(WatchpointType::WRITE, address, oldValue, newValue);
+    if (oldValue != newValue)
+    {
+        watchpointHit(WatchpointType::CHANGE, address, oldValue, newValue);
+    }
+}
+
+void Debugger::portRead(uint16_t port, uint8_t value)
+{
+    watchpointHit(WatchpointType::IN, port, value, value);
+}
+
+void Debugger::portWritten(uint16_t port, uint8_t value)
+{
+    watchpointHit(WatchpointType::OUT, port, value, value);
+}
+
+void Debugger::watchpointHit(WatchpointType type, uint16_t address, uint8_t oldValue, uint8_t newValue)
+{
+    for (auto it = m_watchpoints.begin(); it != m_watchpoints.end(); ++it)
+    {
+        Watchpoint& wp = it->second;
+        if (!wp.enabled || wp.type != type) { continue; }
+
+        bool port = (type == WatchpointType::IN || type == WatchpointType::OUT);
+        bool match = port ? ((address & wp.end) == (wp.start & wp.end))
+                          : (address >= wp.start && address <= wp.end);
+        if (match)
+        {
+            m_pendingHits.push_back({ it->first, type, address, oldValue, newValue, 0, 0 });
+        }
+    }
+}
+
+void Debugger::resolveWatchpointHits(uint16_t pc, int frameCycleNumber)
+{
+    for (WatchpointHit& hit : m_pendingHits)
+    {
+        hit.pc = pc;
+        hit.frameCycleNumber = frameCycleNumber;
+        m_watchpointHits.push_back(hit);
+    }
+    m_pendingHits.clear();
+    if (m_watchpointHits.size() > WATCHPOINT_HITS_MAX)
+    {
+        m_watchpointHits.erase(m_watchpointHits.begin(),
+            m_watchpointHits.end() - WATCHPOINT_HITS_MAX);
+    }
+    breakExecution();
+}
+
 std::vector<InstructionTrace>* Debugger::getTrace()
 {
     return &m_trace;
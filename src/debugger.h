@@ -45,6 +45,29 @@ class Breakpoint {
         bool m_enabled;
 };
 
+enum class WatchpointType { READ = 0, WRITE, CHANGE, IN, OUT };
+
+// Memory watchpoints cover addresses start to end, port watchpoints match
+// when (port & mask) == (start & mask), the mask is kept in end
+struct Watchpoint {
+    WatchpointType type;
+    uint16_t start;
+    uint16_t end;
+    bool enabled;
+};
+
+struct WatchpointHit {
+    int watchpoint;             // Index of the watchpoint
+    WatchpointType type;
+    uint16_t address;           // Memory address or port
+    uint8_t oldValue;           // Only for WRITE and CHANGE
+    uint8_t newValue;           // Value read or written
+    uint16_t pc;                // Instruction doing the access
+    int frameCycleNumber;       // T-state of the instruction since interrupt
+};
+
+#define WATCHPOINT_HITS_MAX 256
+
 struct InstructionTrace {
     uint16_t address;
     Z80Registers registers;
@@ -56,15 +79,35 @@ struct InstructionTrace {
     std::vector<uint8_t> opcodeBytes;
 };
 
-class Debugger {
+class Debugger : public MemoryWatcher {
     public:
         Debugger();
 
+        // Memory watched by the watchpoints
+        void setMemory(SpectrumMemory* memory);
+
         int addBreakpoint(Breakpoint breakpoint);
         void removeBreakpoint(int index);
         int getBreakpointsCount();
         std::map<int, Breakpoint>* getBreakpoints();
 
+        int addWatchpoint(Watchpoint watchpoint);
+        void removeWatchpoint(int index);
+        std::map<int, Watchpoint>* getWatchpoints();
+        // Call after changing watchpoints, updates the memory page flags
+        void updateWatchpoints();
+
+        std::vector<WatchpointHit>* getWatchpointHits();
+        virtual void memoryRead(uint16_t address, uint8_t value) override;
+        virtual void memoryWritten(uint16_t address, uint8_t oldValue, uint8_t newValue) override;
+        void portRead(uint16_t port, uint8_t value);
+        void portWritten(uint16_t port, uint8_t value);
+        inline bool hasPortWatchpoints() { return m_watchPorts; }
+
+        // Hits are collected during an instruction and completed once it finishes
+        inline bool hasPendingWatchpointHits() { return !m_pendingHits.empty(); }
+        void resolveWatchpointHits(uint16_t pc, int frameCycleNumber);
+
         std::vector<InstructionTrace>* getTrace();
         void addTrace(InstructionTrace trace);
         int selectedTrace;
@@ -80,7 +123,14 @@ class Debugger {
         // Replace mnemonic data with actual current data
         void parseMnemonicData(InstructionTrace* t);
     private:
+        void watchpointHit(WatchpointType type, uint16_t address, uint8_t oldValue, uint8_t newValue);
+
         std::map<int, Breakpoint> m_breakpoints;
+        std::map<int, Watchpoint> m_watchpoints;
+        std::vector<WatchpointHit> m_pendingHits;
+        std::vector<WatchpointHit> m_watchpointHits;
+        SpectrumMemory* m_memory;
+        bool m_watchPorts;
         std::vector<InstructionTrace> m_trace;
         int m_lastIndex;
         bool m_breakExecution;
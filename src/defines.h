@@ -10,6 +10,9 @@
     #define NDEBUG
 #endif
 
+// Define ZXPP_HEATMAP in the build to count memory accesses per address for
+// the heatmap window, this adds an increment to every memory access
+
 #endif
 
 // Choose file dialog for the platform
@@ -3,15 +3,24 @@
 #include "defines.h"
 
 #include <type_traits>
+#include <vector>
+#include <stdint.h>
 
 class IDevice {
     public:
     
-    // Called when OUT instruction is executed
-    virtual void receiveData(uint8_t data, uint16_t port) = 0;
+    // Called when OUT instruction is executed. tState is the T-state of the
+    // frame the access happens at, devices bring their state up to it when
+    // accessed instead of being stepped with every instruction
+    virtual void receiveData(uint8_t data, uint16_t port, int tState) = 0;
 
     // Called when IN instruction is executed, should return true if this device
     // responds to the specified port address and place the byte on data bus
     // in out
-    virtual bool sendData(uint8_t& out, uint16_t port) = 0;
+    virtual bool sendData(uint8_t& out, uint16_t port, int tState) = 0;
+
+    // Devices with internal state append it to out for machine snapshots,
+    // loadState reads it back and advances in past it
+    virtual void saveState(std::vector<uint8_t>& out) {}
+    virtual void loadState(const uint8_t*& in) {}
 };
\ No newline at end of file
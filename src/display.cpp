@@ -1,11 +1,18 @@
 #include "display.h"
 
-Display::Display(Spectrum48KMemory* memory)
-    : m_memory(memory),
-      m_inverted(false),
-      m_frames(0),
+#include <cstring>
+
+Display::Display(ULA* ula)
+    : m_ula(ula),
+      m_mode(DisplayMode::ULA_FRAME),
+      m_frameVersion(-1),
+      m_pboID(0),
+      m_pboData(nullptr),
+      m_pboSlot(0),
       m_scale(2.0f)
 {
+    for (GLsync& fence : m_pboFences) { fence = 0; }
+
     // TODO: error handling
     generateVertexBuffer();
     generateUVs();
@@ -39,30 +46,29 @@ Display::Display(Spectrum48KMemory* memory)
     glLogLastError();
     glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
     glLogLastError();
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, DISPLAY_WIDTH, DISPLAY_HEIGHT, 0, GL_BGR, GL_UNSIGNED_BYTE, m_pixels);
-    glLogLastError();
+    allocateTexture(GL_RGBA8, DISPLAY_WIDTH, DISPLAY_HEIGHT, GL_BGRA);
+    createPixelBuffers();
 
-    GLuint vertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-    GLuint fragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
-    std::string vertexShaderCode = readFileToString(VERTEX_SHADER_FILE);
-    std::string fragmentShaderCode = readFileToString(FRAGMENT_SHADER_FILE);
-    compileShader(vertexShaderCode, vertexShaderID);
-    glLogLastError();
-    compileShader(fragmentShaderCode, fragmentShaderID);
+    // Integer textures are only complete with nearest filtering
+    glGenTextures(1, &m_screenTextureID);
     glLogLastError();
-    GLuint programID = linkShaderProgram(vertexShaderID, fragmentShaderID);
+    glBindTexture(GL_TEXTURE_2D, m_screenTextureID);
     glLogLastError();
-    glDetachShader(programID, vertexShaderID);
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
     glLogLastError();
-    glDetachShader(programID, fragmentShaderID);
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
     glLogLastError();
+    allocateTexture(GL_R8UI, SCREEN_TEXTURE_WIDTH, SCREEN_TEXTURE_HEIGHT, GL_RED_INTEGER);
 
-    glDeleteShader(vertexShaderID);
-    glLogLastError();
-    glDeleteShader(fragmentShaderID);
-    glLogLastError();
+    GLuint programID = loadShaderProgram(VERTEX_SHADER_FILE, FRAGMENT_SHADER_FILE);
+    m_screenProgramID = loadShaderProgram(VERTEX_SHADER_FILE, SCREEN_FRAGMENT_SHADER_FILE);
 
     m_samplerID = glGetUniformLocation(programID, "inTexture");
+    m_mvpID = glGetUniformLocation(programID, "MVP");
+    m_screenMvpID = glGetUniformLocation(m_screenProgramID, "MVP");
+    m_screenSamplerID = glGetUniformLocation(m_screenProgramID, "inScreen");
+    m_borderID = glGetUniformLocation(m_screenProgramID, "border");
+    m_flashInvertedID = glGetUniformLocation(m_screenProgramID, "flashInverted");
 
     std::cout << "OpenGL buffers initialized" << std::endl;
     glLogLastError();
@@ -72,76 +78,72 @@ Display::Display(Spectrum48KMemory* memory)
 
 Display::~Display()
 {
+    for (GLsync fence : m_pboFences)
+    {
+        if (fence) { glDeleteSync(fence); }
+    }
+    if (m_pboID)
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pboID);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glDeleteBuffers(1, &m_pboID);
+    }
     glDeleteBuffers(1, &m_vboID);
 	glDeleteBuffers(1, &m_uvID);
 	glDeleteProgram(m_programID);
-	glDeleteTextures(1, &m_samplerID);
+	glDeleteProgram(m_screenProgramID);
+	glDeleteTextures(1, &m_textureID);
+	glDeleteTextures(1, &m_screenTextureID);
 	glDeleteVertexArrays(1, &m_vaoID);
 }
 
-void Display::draw(int windowWidth, int windowHeight)
+void Display::draw(int windowWidth, int windowHeight, const VideoFrame& frame)
 {
     // TODO: error handling
 
-    for (uint8_t y = 0; y < DISPLAY_HEIGHT; y++)
+    // Skip texture upload when the frame did not change. After a mode
+    // switch, frames in the old format may still be on their way
+    bool usable = (m_mode == DisplayMode::GPU_DECODE) || frame.hasPixels;
+    bool changed = usable && frame.version != m_frameVersion;
+    if (changed)
     {
-        for (uint8_t x = 0; x < DISPLAY_WIDTH/8; x++)
-        {
-            uint16_t memY = 0x4000 | ((y >> 6) << 11);
-            memY |= (y & 0x7) << 8;
-            memY |= ((y >> 3) & 0x7) << 5;
-
-            uint16_t memPos = memY |= x;
-            for (uint8_t bit = 0; bit < 8; bit++)
-            {
-                // Find the corresponding color attributes
-                // http://www.animatez.co.uk/computers/zx-spectrum/screen-memory-layout/
-                int xReal = x * 8 + bit;
-                uint16_t memCol = 0x5800 + ( (y / 8) * (DISPLAY_WIDTH / 8) + (xReal / 8) );
-                uint8_t attributes = (*m_memory)[memCol];
-
-                // Find the color (each is stored as 1 bit per channel in GRB format)
-                bool col = ((*m_memory)[memPos] & (1 << (7 - bit)));
-                col = (m_inverted && (col >> 7)) ? !col : col;
-                uint8_t r = col ? (attributes & 0x2) >> 1 : (attributes & 0x10) >> 4;
-                uint8_t g = col ? (attributes & 0x4) >> 2 : (attributes & 0x20) >> 5;
-                uint8_t b = col ? (attributes & 0x1) : (attributes & 0x8) >> 3;
-
-                // Adjust by brightness flag
-                r *= (attributes & 0x40) ? 255 : 128;
-                g *= (attributes & 0x40) ? 255 : 128;
-                b *= (attributes & 0x40) ? 255 : 128;
-
-                m_pixels[ (DISPLAY_WIDTH * y + (x*8+bit)) * 3 ] = b;
-                m_pixels[ (DISPLAY_WIDTH * y + (x*8+bit)) * 3 + 1 ] = g;
-                m_pixels[ (DISPLAY_WIDTH * y + (x*8+bit)) * 3 + 2 ] = r;
-
-            }
-        }
+        m_frameVersion = frame.version;
     }
 
-    glDraw(windowWidth, windowHeight);
-
-    m_frames++;
-    if (m_frames > 15)
-    {
-        m_frames = 0;
-        m_inverted = !m_inverted;
-    }
+    glDraw(windowWidth, windowHeight, frame, changed);
 }
 
-void Display::glDraw(int width, int height)
+void Display::glDraw(int width, int height, const VideoFrame& frame, bool upload)
 {
-    glUseProgram(m_programID);
+    bool gpuDecode = (m_mode == DisplayMode::GPU_DECODE);
+    glUseProgram(gpuDecode ? m_screenProgramID : m_programID);
     mat4 mvp = multiply(projectionOrtho((GLfloat)width, (GLfloat)height, -1.0f, 1.0f),
         scaleMatrix(m_scale, m_scale));
 
-    GLuint MatrixID = glGetUniformLocation(m_programID, "MVP");
-    glUniformMatrix4fv(MatrixID, 1, GL_FALSE, mvp.data());
+    glUniformMatrix4fv(gpuDecode ? m_screenMvpID : m_mvpID, 1, GL_FALSE, mvp.data());
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, m_textureID);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, DISPLAY_WIDTH, DISPLAY_HEIGHT, 0, GL_BGR, GL_UNSIGNED_BYTE, m_pixels);
-    glUniform1i(m_samplerID, 0);
+    if (gpuDecode)
+    {
+        glBindTexture(GL_TEXTURE_2D, m_screenTextureID);
+        if (upload)
+        {
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, SCREEN_TEXTURE_WIDTH, SCREEN_TEXTURE_HEIGHT,
+                GL_RED_INTEGER, GL_UNSIGNED_BYTE, frame.screen);
+        }
+        glUniform1i(m_screenSamplerID, 0);
+        glUniform1i(m_borderID, frame.border);
+        glUniform1i(m_flashInvertedID, frame.flashInverted ? 1 : 0);
+    }
+    else
+    {
+        glBindTexture(GL_TEXTURE_2D, m_textureID);
+        if (upload)
+        {
+            uploadFrame(frame);
+        }
+        glUniform1i(m_samplerID, 0);
+    }
     glEnableVertexAttribArray(0);
     glBindBuffer(GL_ARRAY_BUFFER, m_vboID);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*) 0);
@@ -203,6 +205,103 @@ void Display::generateUVs()
     m_UVs.push_back(0.0f);
 }
 
+void Display::allocateTexture(GLenum internalFormat, int width, int height, GLenum format)
+{
+    if (GLEW_ARB_texture_storage)
+    {
+        glTexStorage2D(GL_TEXTURE_2D, 1, internalFormat, width, height);
+    }
+    else
+    {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, GL_UNSIGNED_BYTE, nullptr);
+    }
+    glLogLastError();
+}
+
+void Display::createPixelBuffers()
+{
+    if (!GLEW_ARB_buffer_storage)
+    {
+        std::cout << "Persistent buffer mapping not supported, uploading from client memory" << std::endl;
+        return;
+    }
+
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(1, &m_pboID);
+    glLogLastError();
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pboID);
+    glLogLastError();
+    glBufferStorage(GL_PIXEL_UNPACK_BUFFER, DISPLAY_PBO_SLOTS * DISPLAY_FRAME_BYTES, nullptr, flags);
+    glLogLastError();
+    m_pboData = (uint8_t*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, DISPLAY_PBO_SLOTS * DISPLAY_FRAME_BYTES, flags);
+    glLogLastError();
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    if (m_pboData == nullptr)
+    {
+        std::cerr << "Failed to map pixel buffer" << std::endl;
+        glDeleteBuffers(1, &m_pboID);
+        m_pboID = 0;
+    }
+}
+
+void Display::uploadFrame(const VideoFrame& frame)
+{
+    if (m_pboID == 0)
+    {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, DISPLAY_WIDTH, DISPLAY_HEIGHT, GL_BGRA, GL_UNSIGNED_BYTE, frame.pixels.data());
+        return;
+    }
+
+    // The slot was last used DISPLAY_PBO_SLOTS uploads ago, that transfer
+    // is normally long finished and the wait returns immediately
+    GLsync& fence = m_pboFences[m_pboSlot];
+    if (fence)
+    {
+        glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        glDeleteSync(fence);
+        fence = 0;
+    }
+
+    size_t offset = (size_t)m_pboSlot * DISPLAY_FRAME_BYTES;
+    memcpy(m_pboData + offset, frame.pixels.data(), DISPLAY_FRAME_BYTES);
+
+    // Unpacking from the buffer returns right away, the copy to the
+    // texture happens asynchronously
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pboID);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, DISPLAY_WIDTH, DISPLAY_HEIGHT, GL_BGRA, GL_UNSIGNED_BYTE, (void*)offset);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    m_pboSlot = (m_pboSlot + 1) % DISPLAY_PBO_SLOTS;
+}
+
+GLuint Display::loadShaderProgram(const char* vertexFile, const char* fragmentFile)
+{
+    GLuint vertexShaderID = glCreateShader(GL_VERTEX_SHADER);
+    GLuint fragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+    std::string vertexShaderCode = readFileToString(vertexFile);
+    std::string fragmentShaderCode = readFileToString(fragmentFile);
+    compileShader(vertexShaderCode, vertexShaderID);
+    glLogLastError();
+    compileShader(fragmentShaderCode, fragmentShaderID);
+    glLogLastError();
+    GLuint programID = linkShaderProgram(vertexShaderID, fragmentShaderID);
+    glLogLastError();
+    glDetachShader(programID, vertexShaderID);
+    glLogLastError();
+    glDetachShader(programID, fragmentShaderID);
+    glLogLastError();
+
+    glDeleteShader(vertexShaderID);
+    glLogLastError();
+    glDeleteShader(fragmentShaderID);
+    glLogLastError();
+
+    return programID;
+}
+
 bool Display::compileShader(std::string code, GLuint shaderID)
 {
     std::cout << "Compiling " << code.c_str() << "..." << std::endl;
@@ -268,4 +367,18 @@ float Display::getScale()
 void Display::setScale(float scale)
 {
     m_scale = scale;
+}
+
+DisplayMode Display::getMode()
+{
+    return m_mode;
+}
+
+void Display::setMode(DisplayMode mode)
+{
+    m_mode = mode;
+    m_ula->setRendering(mode == DisplayMode::ULA_FRAME);
+
+    // The texture of the other mode is stale
+    m_frameVersion = -1;
 }
\ No newline at end of file
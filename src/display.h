@@ -3,7 +3,7 @@
 
 #include <stdint.h>
 #include <SDL.h>
-#include "memory.h"
+#include "ula.h"
 #include <vector>
 #include <glew.h>
 
@@ -12,20 +12,40 @@
 #include "utils.h"
 #include "gl_utils.h"
 
-#define DISPLAY_WIDTH 256
-#define DISPLAY_HEIGHT 192
+#define DISPLAY_WIDTH FRAME_WIDTH
+#define DISPLAY_HEIGHT FRAME_HEIGHT
 
 #define VERTEX_SHADER_FILE "src/shaders/vertex.glsl"
 #define FRAGMENT_SHADER_FILE "src/shaders/fragment.glsl"
+#define SCREEN_FRAGMENT_SHADER_FILE "src/shaders/fragment_screen.glsl"
+
+// Raw screen memory texture, 32 bytes per row, bitmap then attributes
+#define SCREEN_TEXTURE_WIDTH 32
+#define SCREEN_TEXTURE_HEIGHT (SCREEN_SIZE / SCREEN_TEXTURE_WIDTH)
+
+// Frames in flight, the pixel buffer is split into this many slots
+#define DISPLAY_PBO_SLOTS 3
+#define DISPLAY_FRAME_BYTES (DISPLAY_WIDTH * DISPLAY_HEIGHT * 4)
+
+enum class DisplayMode {
+    ULA_FRAME,      // Upload the frame drawn by the ULA, with raster effects
+    GPU_DECODE      // Upload the screen memory and decode it in the shader
+};
 
 class Display {
     public:
-        Display(Spectrum48KMemory* memory);
+        Display(ULA* ula);
         ~Display();
-        void draw(int windowWidth, int windowHeight);
+        void draw(int windowWidth, int windowHeight, const VideoFrame& frame);
 
         float getScale();
         void setScale(float scale);
+
+        // GPU decoding does no per-pixel work on the CPU, but the border is
+        // drawn in a single color and changes during the frame are not shown.
+        // Switching reconfigures the ULA, the machine has to be locked
+        DisplayMode getMode();
+        void setMode(DisplayMode mode);
     protected:
         // Vertex buffer for two triangles of the display
         void generateVertexBuffer();
@@ -34,12 +54,21 @@ class Display {
 
         bool compileShader(std::string code, GLuint shaderID);
         GLuint linkShaderProgram(GLuint vertexShaderID, GLuint fragmentShaderID);
+        GLuint loadShaderProgram(const char* vertexFile, const char* fragmentFile);
+
+        // Allocate texture storage once, immutable where supported
+        void allocateTexture(GLenum internalFormat, int width, int height, GLenum format);
+        // Ring of persistently mapped pixel buffers, if the driver supports them
+        void createPixelBuffers();
+        // Upload the ULA frame through the next pixel buffer slot
+        void uploadFrame(const VideoFrame& frame);
 
-        // Draw generated pixel buffer using openGL
-        void glDraw(int windowWidth, int windowHeight);
+        // Draw the frame using openGL, upload it first if it changed
+        void glDraw(int windowWidth, int windowHeight, const VideoFrame& frame, bool upload);
     private:
-        Spectrum48KMemory* m_memory;
-        uint8_t m_pixels[DISPLAY_WIDTH*DISPLAY_HEIGHT*3];
+        ULA* m_ula;
+        DisplayMode m_mode;
+        int m_frameVersion;             // Version of the uploaded frame
 
         std::vector<GLfloat> m_vertexBuffer;
         std::vector<GLfloat> m_UVs;
@@ -49,14 +78,22 @@ class Display {
         GLuint m_textureID;
         GLuint m_samplerID;
         GLuint m_uvID;
+        GLint m_mvpID;
 
-        float m_scale;
+        GLuint m_pboID;                 // 0 when persistent mapping is not supported
+        uint8_t* m_pboData;
+        GLsync m_pboFences[DISPLAY_PBO_SLOTS];
+        int m_pboSlot;
 
-        // Are the flashing colors currently inverted?
-        bool m_inverted;
+        // GPU_DECODE mode
+        GLuint m_screenProgramID;
+        GLuint m_screenTextureID;
+        GLint m_screenSamplerID;
+        GLint m_screenMvpID;
+        GLint m_borderID;
+        GLint m_flashInvertedID;
 
-        // Number of frames since last inversion of colors
-        int m_frames;
+        float m_scale;
 };
 
 #endif
\ No newline at end of file
@@ -4,16 +4,152 @@
 Emulator::Emulator(SDL_Window* window)
     : m_window(window),
       m_memory(),
-      m_display(&m_memory),
+      m_paging(&m_memory),
       m_ula(),
-      m_gui(this),
-      m_keyboard(this, &m_gui),
+      m_keyboard(this),
       m_debugger(),
-      m_proc(&m_memory, &m_ula, &m_debugger)
+      m_proc(&m_memory, &m_ula, &m_debugger),
+      m_rewinding(false),
+      m_running(false),
+      m_frameTime(REFRESH_RATE),
+      m_speed(1),
+      m_turbo(false),
+      m_measuredSpeed(0.0),
+      m_runAhead(0),
+      m_publishedVersion(-1),
+      m_frameEvent((Uint32)-1),
+      m_frameEventPending(false),
+      m_vsync(false),
+      m_audioSync(true)
 {
     init();
     m_proc.getIoPorts()->registerDevice((IDevice*)&m_keyboard);
+    m_proc.getIoPorts()->registerDevice(&m_paging);
+    m_proc.getIoPorts()->registerDevice(&m_ula);
+    m_proc.getIoPorts()->registerDevice(&m_beeper);
+    m_proc.getIoPorts()->registerDevice(&m_ay);
+    m_proc.getIoPorts()->registerDevice(&m_tape);
+    m_ula.attach(&m_proc, &m_memory);
+    m_beeper.attach(&m_mixer);
+    m_ay.attach(&m_mixer);
+    m_tape.attach(&m_proc, &m_memory, &m_mixer);
+    m_proc.setTrap(TAPE_LD_BYTES, &m_tape);
+    m_samples.reserve(AUDIO_MAX_QUEUED);
+    m_debugger.setMemory(&m_memory);
+    if (window != nullptr)
+    {
+        m_display.reset(new Display(&m_ula));
+        m_gui.reset(new Gui(this));
+        m_frameEvent = SDL_RegisterEvents(1);
+
+        m_audio.reset(new AudioOutput());
+        if (m_audio->open())
+        {
+            m_mixer.setSampleRate(m_audio->getSampleRate());
+        }
+        else
+        {
+            m_audio.reset();
+        }
+
+        // Screenshots on request
+        CaptureSettings screenshots;
+        screenshots.workers = 1;
+        m_capture.reset(new FrameCapture(screenshots));
+    }
+    else
+    {
+        m_rewind.setEnabled(false);
+    }
+    const MachineModel& model = getMachineModel(m_memory.getMachineType());
+    m_frameTime = model.tStatesPerFrame / model.clockFrequency;
+    m_ay.setMachineModel(model);
+    m_mixer.setClockRate(model.clockFrequency);
     m_prevFrameTime = std::chrono::high_resolution_clock::now();
+    m_lastInput = m_prevFrameTime;
+}
+
+Emulator::~Emulator()
+{
+    stop();
+}
+
+void Emulator::start()
+{
+    if (m_running) { return; }
+    m_running = true;
+    m_thread = std::thread(&Emulator::run, this);
+}
+
+void Emulator::stop()
+{
+    if (!m_running) { return; }
+    m_running = false;
+    m_thread.join();
+}
+
+std::mutex* Emulator::getMachineMutex()
+{
+    return &m_machineMutex;
+}
+
+void Emulator::runHeadless(int frames)
+{
+    for (int i = 0; i < frames; i++)
+    {
+        emulateFrame();
+    }
+    if (m_capture)
+    {
+        m_capture->flush();
+    }
+    if (m_recorder)
+    {
+        m_recorder->flush();
+    }
+}
+
+void Emulator::setCapture(const CaptureSettings& settings)
+{
+    m_capture.reset(new FrameCapture(settings));
+}
+
+FrameCapture* Emulator::getCapture()
+{
+    return m_capture.get();
+}
+
+bool Emulator::startRecording(const RecordSettings& settings)
+{
+    // Audio is recorded as it is synthesized, a frame takes the time of
+    // the emulated one
+    const MachineModel& model = getMachineModel(m_memory.getMachineType());
+    RecordSettings recordSettings = settings;
+    recordSettings.sampleRate = m_mixer.getSampleRate();
+    recordSettings.clockRate = (uint32_t)(model.clockFrequency + 0.5);
+    recordSettings.tStatesPerFrame = model.tStatesPerFrame;
+    m_recorder.reset(new Recorder(recordSettings));
+    if (!m_recorder->isOpen())
+    {
+        m_recorder.reset();
+        return false;
+    }
+    return true;
+}
+
+void Emulator::stopRecording()
+{
+    m_recorder.reset();
+}
+
+Recorder* Emulator::getRecorder()
+{
+    return m_recorder.get();
+}
+
+AudioOutput* Emulator::getAudio()
+{
+    return m_audio.get();
 }
 
 void Emulator::init()
@@ -21,13 +157,17 @@ void Emulator::init()
     std::default_random_engine generator;
     std::uniform_int_distribution<int> distribution(0,255);
     auto dice = std::bind ( distribution, generator );
-    for (int i = 0; i < m_memory.screen_size + m_memory.screenColor_size; i++)
+    for (int i = 0; i < SCREEN_SIZE; i++)
     {
         int dice_roll = dice();
-        *(m_memory.screenMemory + i) = (uint8_t) dice_roll;
+        m_memory.poke(0x4000 + i, (uint8_t) dice_roll);
     }
 
+    m_memory.resetPaging();
+    m_ay.reset();
     m_proc.init();
+    // The clock starts over, the tape stays where it is
+    m_tape.stop();
 }
 
 void Emulator::loadROM(std::string filename)
@@ -39,56 +179,406 @@ void Emulator::loadROM(std::string filename)
     int length = (int)inf.tellg();
     inf.seekg (0, std::ios::beg);
 
-    inf.read((char *)m_memory.ROM, length);
+    std::vector<uint8_t> data(std::max(length, 0));
+    inf.read((char *)data.data(), data.size());
 
     inf.close();
 
+    // 128K ROM images contain both ROMs one after another
+    size_t offset = 0;
+    for (int bank = 0; bank < ROM_BANKS && offset < data.size(); bank++)
+    {
+        offset += m_memory.loadROM(bank, data.data() + offset, data.size() - offset);
+    }
+
     m_ROMfile = filename;
 }
 
+void Emulator::setMachineType(MachineType type)
+{
+    const MachineModel& model = getMachineModel(type);
+    m_memory.setMachineType(type);
+    m_proc.setTStatesPerFrame(model.tStatesPerFrame);
+    m_ula.setMachineModel(model);
+    m_ay.setMachineModel(model);
+    m_mixer.setClockRate(model.clockFrequency);
+    m_frameTime = model.tStatesPerFrame / model.clockFrequency;
+    init();
+}
+
+MachineType Emulator::getMachineType()
+{
+    return m_memory.getMachineType();
+}
+
+void Emulator::saveSnapshot(MachineSnapshot& snapshot)
+{
+    m_proc.saveState(snapshot.cpu);
+    m_memory.saveSnapshot(snapshot.memory);
+    m_proc.getIoPorts()->saveState(snapshot.devices);
+    m_proc.getScheduler()->saveState(snapshot.devices);
+}
+
+void Emulator::loadSnapshot(const MachineSnapshot& snapshot)
+{
+    m_memory.loadSnapshot(snapshot.memory);
+    const MachineModel& model = getMachineModel(snapshot.memory.type);
+    m_proc.setTStatesPerFrame(model.tStatesPerFrame);
+    m_ula.setMachineModel(model);
+    m_ay.setMachineModel(model);
+    m_mixer.setClockRate(model.clockFrequency);
+    m_frameTime = model.tStatesPerFrame / model.clockFrequency;
+    m_proc.loadState(snapshot.cpu);
+    const uint8_t* devices = snapshot.devices.data();
+    m_proc.getIoPorts()->loadState(devices);
+    m_proc.getScheduler()->loadState(devices);
+}
+
+bool Emulator::rewindTo(int frame)
+{
+    MachineSnapshot snapshot;
+    if (!m_rewind.restore(frame, snapshot))
+    {
+        return false;
+    }
+    loadSnapshot(snapshot);
+    return true;
+}
+
+RewindBuffer* Emulator::getRewindBuffer()
+{
+    return &m_rewind;
+}
+
 bool Emulator::loop()
 {
     auto now = std::chrono::high_resolution_clock::now();
     std::chrono::duration<double> timeSpan = std::chrono::duration_cast<std::chrono::duration<double>>(now - m_prevFrameTime);
+    std::chrono::duration<double> sinceInput = now - m_lastInput;
+
+    // Cleared first, a frame published from here on pushes a new event
+    m_frameEventPending = false;
+    bool newFrame = m_frames.acquire();
+
+    // Keep the GUI responsive while the machine is paused, but don't
+    // redraw an unchanged screen more often than needed
+    bool settling = sinceInput.count() < UI_SETTLE_TIME && timeSpan.count() >= REFRESH_RATE;
+    if (!newFrame && !settling && timeSpan.count() < UI_IDLE_REDRAW)
+    {
+        return false;
+    }
+
+    ImGui_ImplSdlGL3_NewFrame(m_window);
+    m_delta = timeSpan;
+    m_prevFrameTime = now;
+    glClearColor(0.2f, 0.2f, 0.2f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    int w, h;
+    SDL_GetWindowSize(m_window, &w, &h);
+    m_display->draw(w, h, m_frames.front());
+
+    std::lock_guard<std::mutex> lock(m_machineMutex);
+    m_gui->draw();
+    return true;
+}
+
+int Emulator::getEventTimeout()
+{
+    auto now = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> timeSpan = now - m_prevFrameTime;
+    std::chrono::duration<double> sinceInput = now - m_lastInput;
+
+    double wait = (sinceInput.count() < UI_SETTLE_TIME ? REFRESH_RATE : UI_IDLE_REDRAW) - timeSpan.count();
+    return std::max(1, (int)(wait * 1000.0));
+}
+
+void Emulator::setVSync(bool enabled)
+{
+    // Late swaps tear instead of waiting a whole refresh where supported
+    if (enabled && SDL_GL_SetSwapInterval(-1) == 0)
+    {
+        m_vsync = true;
+        return;
+    }
+    m_vsync = (SDL_GL_SetSwapInterval(enabled ? 1 : 0) == 0) && enabled;
+}
+
+bool Emulator::getVSync()
+{
+    return m_vsync;
+}
+
+void Emulator::setAudioSync(bool enabled)
+{
+    m_audioSync = enabled;
+}
+
+bool Emulator::getAudioSync()
+{
+    return m_audioSync;
+}
+
+double Emulator::getFrameTime()
+{
+    return m_frameTime;
+}
+
+void Emulator::setSpeed(int speed)
+{
+    m_speed = std::max(speed, 0);
+}
+
+int Emulator::getSpeed()
+{
+    return m_speed;
+}
+
+double Emulator::getMeasuredSpeed()
+{
+    return m_measuredSpeed;
+}
+
+void Emulator::setRunAhead(int frames)
+{
+    m_runAhead = std::min(std::max(frames, 0), RUN_AHEAD_MAX);
+}
+
+int Emulator::getRunAhead()
+{
+    return m_runAhead;
+}
+
+void Emulator::run()
+{
+    typedef std::chrono::steady_clock clock;
+
+    // The display's refresh rate rarely matches the machine, so the
+    // emulation keeps its own clock even with vsync
+    FramePacer pacer;
+    RateControl rate;
+    bool late = false;
+    int skipped = 0;
+    int measuredFrames = 0;
+    clock::time_point measureStart = clock::now();
+    while (m_running)
+    {
+        int speed = m_turbo ? SPEED_UNLIMITED : m_speed.load();
+        double frameTime = m_frameTime;
+        bool emulated;
+        if (speed == 1)
+        {
+            // Slow hosts leave some frames undrawn to keep the emulation speed
+            bool skip = late && skipped < FRAMESKIP_MAX;
+            skipped = skip ? skipped + 1 : 0;
+            emulated = emulateFrame(skip);
+            measuredFrames += emulated ? 1 : 0;
+        }
+        else
+        {
+            // Several frames per host frame, only the last one is drawn.
+            // Unlimited speed fills the host frame with skipped frames
+            clock::time_point end = clock::now() + std::chrono::duration_cast<clock::duration>(
+                std::chrono::duration<double>(frameTime));
+            int frames = 0;
+            do
+            {
+                emulated = emulateFrame(true);
+                frames++;
+            } while (emulated && m_running
+                && (speed == SPEED_UNLIMITED ? clock::now() < end : frames < speed - 1));
+            if (emulated)
+            {
+                emulateFrame(false);
+                measuredFrames += frames + 1;
+            }
+        }
+
+        // Synced to audio the device's clock sets the pace. The wall clock
+        // would drift against it over time and the queue under- or overrun
+        double waitTime = frameTime;
+        if (emulated && speed == 1 && m_audioSync && m_audio)
+        {
+            double target = AUDIO_SYNC_LATENCY * m_audio->getSampleRate();
+            double queued = (double)m_audio->getQueued();
+            if (queued < target / 2)
+            {
+                // Drained by a pause or a stall, refill without waiting
+                rate.reset();
+                pacer.reset();
+                late = false;
+                continue;
+            }
+            waitTime = rate.adjust(frameTime, queued, target);
+        }
+        else
+        {
+            rate.reset();
+        }
+        late = !pacer.wait(waitTime, emulated && speed != SPEED_UNLIMITED);
+
+        std::chrono::duration<double> elapsed = clock::now() - measureStart;
+        if (elapsed.count() >= SPEED_MEASURE_TIME)
+        {
+            m_measuredSpeed = measuredFrames * frameTime / elapsed.count();
+            measuredFrames = 0;
+            measureStart = clock::now();
+        }
+    }
+}
+
+bool Emulator::emulateFrame(bool skip)
+{
+    std::lock_guard<std::mutex> lock(m_machineMutex);
+    processInput();
+
+    bool emulated = false;
+    int runAheadFrames = m_runAhead;
+    if (skip || !m_display || m_debugger.getBreakpointsCount() > 0 || !m_debugger.getWatchpoints()->empty())
+    {
+        runAheadFrames = 0;
+    }
     if (m_debugger.shouldBreak() && !m_debugger.shouldBreakNextFrame())
-    { 
-        if (timeSpan.count() >= REFRESH_RATE)
+    {
+        // Paused, show changes made by the memory editor or the rewind slider
+        m_ula.update();
+        captureFrame(false);
+    }
+    else if (m_rewinding)
+    {
+        rewindTo(m_rewind.getPosition() - 1);
+        m_ula.update();
+        captureFrame(false);
+    }
+    else
+    {
+        // With run-ahead the real frame is never shown
+        m_ula.setSkipping(skip || runAheadFrames > 0);
+        m_proc.simulateFrame();
+        m_ula.endFrame();
+        // Captured and recorded frames are drawn even when skipped
+        captureFrame(true);
+        if (m_recorder)
         {
-            ImGui_ImplSdlGL3_NewFrame(m_window);
-            glClearColor(0.2f, 0.2f, 0.2f, 1.0f);
-            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-            int w, h;
-            SDL_GetWindowSize(m_window, &w, &h);
-            m_display.draw(w, h);
-            m_gui.draw();
-            return true;
+            m_recorder->addFrame(m_ula.renderFrame());
         }
-        return false;
+        m_ula.setSkipping(false);
+        outputAudio();
+#ifdef ZXPP_HEATMAP
+        // Nobody looks at the counters while the window is closed, it
+        // clears them when it opens
+        if (m_gui && m_gui->isHeatmapOpen())
+        {
+            m_memory.getHeatmap()->decay();
+        }
+#endif
+        if (m_rewind.isEnabled())
+        {
+            MachineSnapshot snapshot;
+            saveSnapshot(snapshot);
+            m_rewind.push(std::move(snapshot));
+        }
+        m_debugger.endLoop();
+        emulated = true;
     }
-    if ((timeSpan.count() >= REFRESH_RATE) || (m_debugger.shouldBreakNextFrame()))
+
+    if (emulated && runAheadFrames > 0)
     {
-        ImGui_ImplSdlGL3_NewFrame(m_window);
-        m_delta = timeSpan;
-        glClearColor(0.2f, 0.2f, 0.2f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        runAhead(runAheadFrames);
+    }
+    else if (m_display && !(emulated && skip))
+    {
+        publishFrame();
+    }
+    return emulated;
+}
+
+void Emulator::outputAudio()
+{
+    m_samples.clear();
+    m_beeper.endFrame();
+    m_ay.endFrame();
+    m_tape.endFrame();
+    m_mixer.endFrame(getMachineModel(m_memory.getMachineType()).tStatesPerFrame, m_samples);
+    if (m_recorder)
+    {
+        m_recorder->addAudio(m_samples.data(), m_samples.size());
+    }
 
-        m_prevFrameTime = std::chrono::high_resolution_clock::now();
+    // Faster than real time the device couldn't keep up, stay quiet
+    if (m_audio && !m_turbo && m_speed == 1)
+    {
+        m_audio->push(m_samples.data(), m_samples.size());
+    }
+}
 
-        int w, h;
-        SDL_GetWindowSize(m_window, &w, &h);
+void Emulator::runAhead(int frames)
+{
+    // Snapshots share the memory pages, only pages written by the
+    // speculative frames get copied
+    MachineSnapshot snapshot;
+    saveSnapshot(snapshot);
+#ifdef ZXPP_HEATMAP
+    // Snapshots don't hold the heatmap, the speculative frames aren't counted
+    m_memory.getHeatmap()->counting = 0;
+#endif
 
-        m_proc.nmi();
+    for (int i = 0; i < frames; i++)
+    {
+        m_ula.setSkipping(i < frames - 1);
         m_proc.simulateFrame();
-        m_display.draw(w, h);
-        m_gui.draw();
+        m_ula.endFrame();
+        m_beeper.discardFrame();
+        m_ay.discardFrame();
+        m_tape.discardFrame();
+    }
+    m_ula.setSkipping(false);
+#ifdef ZXPP_HEATMAP
+    m_memory.getHeatmap()->counting = 1;
+#endif
+    publishFrame();
 
-        // m_pressedKeys.clear();
-        m_debugger.endLoop();
-        return true;
+    // Marks the screen for a full redraw, the ULA frame now shows the future
+    loadSnapshot(snapshot);
+}
+
+void Emulator::processInput()
+{
+    KeyEvent event;
+    while (m_input.pop(event))
+    {
+        m_pressedKeys.erase(
+            std::remove(m_pressedKeys.begin(), m_pressedKeys.end(), event.key),
+            m_pressedKeys.end());
+        if (event.pressed)
+        {
+            m_pressedKeys.push_back(event.key);
+        }
     }
+}
 
-    return false;
+void Emulator::captureFrame(bool emulated)
+{
+    if (m_capture && m_capture->nextFrame(emulated))
+    {
+        m_capture->capture(m_ula.renderFrame());
+    }
+}
 
+void Emulator::publishFrame()
+{
+    if (m_ula.getFrameVersion() == m_publishedVersion) { return; }
+    m_publishedVersion = m_ula.getFrameVersion();
+    m_ula.copyFrame(m_frames.back());
+    m_frames.publish();
+
+    // Wake up the UI thread if it waits for events
+    if (!m_frameEventPending.exchange(true))
+    {
+        SDL_Event event = {};
+        event.type = m_frameEvent;
+        SDL_PushEvent(&event);
+    }
 }
 
 double Emulator::getDeltaTime()
@@ -104,7 +594,17 @@ void Emulator::reset()
 
 Display* Emulator::getDisplay()
 {
-    return &m_display;
+    return m_display.get();
+}
+
+ULA* Emulator::getULA()
+{
+    return &m_ula;
+}
+
+Gui* Emulator::getGui()
+{
+    return m_gui.get();
 }
 
 Debugger* Emulator::getDebugger()
@@ -114,27 +614,62 @@ Debugger* Emulator::getDebugger()
 
 void Emulator::processEvent(SDL_Event e)
 {
-    m_gui.handleInput(e);
+    if (e.type == m_frameEvent) { return; }
+    m_lastInput = std::chrono::high_resolution_clock::now();
+
+    if (m_gui)
+    {
+        m_gui->handleInput(e);
+    }
 
     switch (e.type)
     {
         case SDL_KEYDOWN:
-            m_pressedKeys.push_back(e.key.keysym.sym);
+            if (e.key.keysym.sym == REWIND_KEY && !ImGui::GetIO().WantTextInput)
+            {
+                m_rewinding = true;
+                break;
+            }
+            if (e.key.keysym.sym == TURBO_KEY && !ImGui::GetIO().WantTextInput)
+            {
+                m_turbo = true;
+                break;
+            }
+            setKey(e.key.keysym.sym, true);
             break;
         case SDL_KEYUP:
-            m_pressedKeys.erase(
-                std::remove(m_pressedKeys.begin(), m_pressedKeys.end(), e.key.keysym.sym),
-                m_pressedKeys.end());
+            if (e.key.keysym.sym == REWIND_KEY)
+            {
+                m_rewinding = false;
+            }
+            if (e.key.keysym.sym == TURBO_KEY)
+            {
+                m_turbo = false;
+            }
+            setKey(e.key.keysym.sym, false);
             break;
     }
 }
 
+void Emulator::setKey(SDL_Keycode key, bool pressed)
+{
+    if (!m_input.push({ key, pressed }))
+    {
+        std::cerr << "Input queue full, key " << (pressed ? "press" : "release") << " lost" << std::endl;
+    }
+}
+
 std::vector<SDL_Keycode>* Emulator::getPressedKeys()
 {
     return &m_pressedKeys;
 }
 
-Spectrum48KMemory* Emulator::getMemory()
+Tape* Emulator::getTape()
+{
+    return &m_tape;
+}
+
+SpectrumMemory* Emulator::getMemory()
 {
     return &m_memory;
 }
@@ -6,58 +6,217 @@
 #include "memory.h"
 #include "display.h"
 #include "ula.h"
+#include "beeper.h"
+#include "ay.h"
+#include "tape.h"
+#include "mixer.h"
+#include "audio.h"
 #include "keyboard.h"
 #include "gui.h"
 
 #include "debugger.h"
+#include "snapshot.h"
+#include "rewind.h"
+#include "triplebuffer.h"
+#include "spscqueue.h"
+#include "capture.h"
+#include "recorder.h"
+#include "pacing.h"
 
 #include <string>
 #include <random>
 #include <fstream>
 #include <functional>
 #include <algorithm>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
 
 #include "3rdparty/imgui/impl/imgui_impl.h"
 
-#define REFRESH_RATE (1.0/50.0)
-
+#define REFRESH_RATE (1.0/50.0)         // Nominal, the emulation runs at the rate of the machine model
+#define REWIND_KEY SDLK_BACKSPACE       // Hold to run backwards
+#define TURBO_KEY SDLK_TAB              // Hold to run unthrottled
+#define SPEED_UNLIMITED 0
+#define FRAMESKIP_MAX 4                 // Frames in a row a slow host may leave undrawn
+#define SPEED_MEASURE_TIME 0.5          // Seconds over which the achieved speed is averaged
+#define RUN_AHEAD_MAX 4
+#define AUDIO_SYNC_LATENCY 0.035        // Seconds of sound queued after a frame when synced to audio
+#define UI_SETTLE_TIME 0.5              // Seconds after an input during which the GUI redraws at the frame rate
+#define UI_IDLE_REDRAW 0.5              // Seconds between GUI redraws when nothing happens
+#define INPUT_QUEUE_SIZE 256
+
+// Key press or release, sent from the UI thread to the emulation thread
+struct KeyEvent {
+    SDL_Keycode key;
+    bool pressed;
+};
+
+// The machine runs on its own thread, paced to 50 Hz. The UI thread draws the
+// frames it publishes and holds the machine lock only while ImGui inspects
+// or changes the machine, never while drawing or waiting for vsync
 class Emulator {
     public:
+        // Without a window there is no display and no GUI (headless)
         Emulator(SDL_Window* window);
+        ~Emulator();
+
+        // Start and stop the emulation thread, the machine may be
+        // configured directly before start()
+        void start();
+        void stop();
+
+        // Held by the emulation thread while it runs a frame
+        std::mutex* getMachineMutex();
+
+        // Emulate frames as fast as possible on the calling thread, then
+        // wait for captured and recorded frames to be written
+        void runHeadless(int frames);
+
+        // Replace the frame capture, before start() or with the machine locked
+        void setCapture(const CaptureSettings& settings);
+        FrameCapture* getCapture();
+
+        // Record emulated frames to disk, with the machine locked or
+        // before start(). Returns false if the output can't be opened
+        bool startRecording(const RecordSettings& settings);
+        void stopRecording();
+        // Null when not recording
+        Recorder* getRecorder();
+
+        // Null without a window or when no audio device could be opened
+        AudioOutput* getAudio();
 
         void loadROM(std::string filename);
 
-        // Compute and display 1 frame
-        // Checks the frame time of 50Hz, returns if frame was actually rendered
-        bool loop();
+        // The cassette deck, the ROM loader reads the inserted tape
+        // instantly. Change it with the machine locked or before start()
+        Tape* getTape();
+
+        // Switch to another machine model and reset it
+        void setMachineType(MachineType type);
+        MachineType getMachineType();
 
-        // Get time in seconds since last frame
+        // Draw the latest frame and the GUI, called by the UI thread
+        // Returns if anything was rendered (a new frame, recent input or
+        // the idle redraw)
+        bool loop();
+        // Milliseconds the UI thread may wait for events before it has to
+        // call loop() again. New frames wake it up with a frame event
+        int getEventTimeout();
+
+        // Swap buffers on vertical blank, called by the UI thread
+        void setVSync(bool enabled);
+        bool getVSync();
+        // Let the sound device's clock drive the emulation at normal speed,
+        // the frame period is adjusted slightly to keep the queued sound
+        // near AUDIO_SYNC_LATENCY. Without sound the wall clock is used
+        void setAudioSync(bool enabled);
+        bool getAudioSync();
+
+        // Get time in seconds since last rendered frame
         double getDeltaTime();
 
         void reset();
 
+        // Cheap to take, memory is copied page by page as it gets written to.
+        // Debugger state is not part of the snapshot
+        void saveSnapshot(MachineSnapshot& snapshot);
+        void loadSnapshot(const MachineSnapshot& snapshot);
+
+        // Restore a frame recorded by the rewind buffer, 0 is the oldest
+        bool rewindTo(int frame);
+        RewindBuffer* getRewindBuffer();
+
         Display* getDisplay();
+        ULA* getULA();
+        Gui* getGui();
         Debugger* getDebugger();
-        Spectrum48KMemory* getMemory();
+        SpectrumMemory* getMemory();
+
+        // Seconds per frame of the current machine model (50.08 Hz on 48K)
+        double getFrameTime();
+
+        // Emulated frames per host frame, SPEED_UNLIMITED runs as fast as
+        // possible. Only the last frame of each host frame is drawn
+        void setSpeed(int speed);
+        int getSpeed();
+        // Achieved speed relative to the real machine, 0 while paused
+        double getMeasuredSpeed();
+
+        // Show the machine this many frames ahead, to hide the input lag
+        // of games that read the keyboard late. Every frame is followed by
+        // speculative frames with the current input, the last one is shown
+        // and the machine is restored. Off while breakpoints or
+        // watchpoints are set, they would hit in the speculative frames
+        void setRunAhead(int frames);
+        int getRunAhead();
 
         void processEvent(SDL_Event e);
+        // Press or release a host key, thread safe (one producer)
+        void setKey(SDL_Keycode key, bool pressed);
+        // Keys held on the host keyboard, owned by the emulation thread
         std::vector<SDL_Keycode>* getPressedKeys();
     protected:
         void init();
+
+        // Emulation thread
+        void run();
+        // Returns false if the machine is paused or rewinding. A skipped
+        // frame is emulated but not drawn
+        bool emulateFrame(bool skip = false);
+        // Hand the sound of the emulated frame to the device and the recorder
+        void outputAudio();
+        // Emulate and publish frames ahead, then return to the current state
+        void runAhead(int frames);
+        void processInput();
+        void publishFrame();
+        // Serve capture requests, emulated is false for frames shown while paused
+        void captureFrame(bool emulated);
     private:
         Z80 m_proc;
-        Spectrum48KMemory m_memory;
-        Display m_display;
+        SpectrumMemory m_memory;
+        PagingDevice m_paging;
+        std::unique_ptr<Display> m_display;
         ULA m_ula;
+        Beeper m_beeper;
+        AY m_ay;
+        Tape m_tape;
+        AudioMixer m_mixer;
+        std::unique_ptr<AudioOutput> m_audio;
+        std::vector<int16_t> m_samples;         // Audio of the last frame
         Keyboard m_keyboard;
         Debugger m_debugger;
-        Gui m_gui;
+        std::unique_ptr<Gui> m_gui;
+        std::unique_ptr<FrameCapture> m_capture;
+        std::unique_ptr<Recorder> m_recorder;
+        RewindBuffer m_rewind;
+        std::atomic<bool> m_rewinding;
         std::string m_ROMfile;
 
         std::vector<SDL_Keycode> m_pressedKeys;
+        SPSCQueue<KeyEvent, INPUT_QUEUE_SIZE> m_input;
 
         SDL_Window* m_window;
 
+        std::thread m_thread;
+        std::atomic<bool> m_running;
+        std::mutex m_machineMutex;
+        std::atomic<double> m_frameTime;
+        std::atomic<int> m_speed;
+        std::atomic<bool> m_turbo;
+        std::atomic<double> m_measuredSpeed;
+        std::atomic<int> m_runAhead;
+        TripleBuffer<VideoFrame> m_frames;
+        int m_publishedVersion;
+        Uint32 m_frameEvent;                        // SDL event type pushed for new frames
+        std::atomic<bool> m_frameEventPending;      // Not handled by loop() yet, don't push more
+
+        bool m_vsync;
+        std::atomic<bool> m_audioSync;
         std::chrono::time_point<std::chrono::high_resolution_clock> m_prevFrameTime;
+        std::chrono::time_point<std::chrono::high_resolution_clock> m_lastInput;
         std::chrono::duration<double> m_delta;
 };
\ No newline at end of file
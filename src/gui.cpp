@@ -9,9 +9,12 @@
 
 Gui::Gui(Emulator* emu)
     : m_renderMenu(true),
+      m_renderInsertTape(false),
       m_renderDebugger(false),
       m_renderMemoryEditor(false),
-      m_emu(emu)
+      m_renderHeatmap(false),
+      m_emu(emu),
+      m_heatmapTexture(0)
 {
     uploadTextures();
 }
@@ -26,6 +29,10 @@ void Gui::draw()
     {
         renderLoadRomWindow();
     }
+    if (m_renderInsertTape)
+    {
+        renderInsertTapeWindow();
+    }
     if (m_renderDebugger)
     {
         renderDebugger();
@@ -38,6 +45,10 @@ void Gui::draw()
     {
         renderVirtualKeyboard();
     }
+    if (m_renderHeatmap)
+    {
+        renderHeatmap();
+    }
 }
 
 void Gui::handleInput(SDL_Event &e)
@@ -52,6 +63,25 @@ void Gui::renderMenu()
         if (ImGui::BeginMenu("File"))
         {
             if (ImGui::MenuItem("Load ROM")) { m_renderLoadROM = true; }
+            if (ImGui::MenuItem("Insert tape")) { m_renderInsertTape = true; }
+            Tape* tape = m_emu->getTape();
+            if (ImGui::MenuItem("Play tape", NULL, tape->isPlaying(), tape->isInserted()))
+            {
+                if (tape->isPlaying()) { tape->stop(); } else { tape->play(); }
+            }
+            if (ImGui::MenuItem("Rewind tape", NULL, false, tape->isInserted())) { tape->rewind(); }
+            if (ImGui::MenuItem("Eject tape", NULL, false, tape->isInserted())) { tape->eject(); }
+            if (ImGui::MenuItem("Save screenshot")) { m_emu->getCapture()->request(); }
+            if (m_emu->getRecorder() == nullptr)
+            {
+                if (ImGui::MenuItem("Start recording"))
+                {
+                    RecordSettings settings;
+                    settings.audio = "recording.wav";
+                    m_emu->startRecording(settings);
+                }
+            }
+            else if (ImGui::MenuItem("Stop recording")) { m_emu->stopRecording(); }
             ImGui::EndMenu();
         }
         if (ImGui::BeginMenu("Edit"))
@@ -59,6 +89,20 @@ void Gui::renderMenu()
             // TODO: hotkeys
             if (ImGui::MenuItem("Reset machine", "CTRL+R")) { m_emu->reset(); }
             if (ImGui::MenuItem("Settings", "CTRL+K")) {}
+            if (ImGui::BeginMenu("Machine"))
+            {
+                MachineType types[] = { MachineType::SPECTRUM_48K, MachineType::SPECTRUM_128K };
+                for (MachineType type : types)
+                {
+                    const MachineModel& model = getMachineModel(type);
+                    if (ImGui::MenuItem(model.name.c_str(), NULL, m_emu->getMachineType() == type))
+                    {
+                        m_emu->setMachineType(type);
+                        m_emu->loadROM(model.defaultROM);
+                    }
+                }
+                ImGui::EndMenu();
+            }
             if (ImGui::BeginMenu("Display scale"))
             {
                 static float s = m_emu->getDisplay()->getScale();
@@ -72,6 +116,46 @@ void Gui::renderMenu()
 
                 m_emu->getDisplay()->setScale(s);
             }
+            Display* display = m_emu->getDisplay();
+            bool gpuDecode = display->getMode() == DisplayMode::GPU_DECODE;
+            if (ImGui::MenuItem("Decode screen on GPU", NULL, gpuDecode))
+            {
+                display->setMode(gpuDecode ? DisplayMode::ULA_FRAME : DisplayMode::GPU_DECODE);
+            }
+            if (ImGui::BeginMenu("Speed"))
+            {
+                int speeds[] = { 1, 2, 4, 8, SPEED_UNLIMITED };
+                for (int speed : speeds)
+                {
+                    std::string label = (speed == SPEED_UNLIMITED) ? "Unlimited" : std::to_string(speed) + "x";
+                    if (ImGui::MenuItem(label.c_str(), (speed == SPEED_UNLIMITED) ? "Hold TAB" : NULL,
+                        m_emu->getSpeed() == speed))
+                    {
+                        m_emu->setSpeed(speed);
+                    }
+                }
+                ImGui::EndMenu();
+            }
+            if (ImGui::BeginMenu("Run-ahead"))
+            {
+                for (int frames = 0; frames <= RUN_AHEAD_MAX; frames++)
+                {
+                    std::string label = (frames == 0) ? "Off" : std::to_string(frames) + (frames == 1 ? " frame" : " frames");
+                    if (ImGui::MenuItem(label.c_str(), NULL, m_emu->getRunAhead() == frames))
+                    {
+                        m_emu->setRunAhead(frames);
+                    }
+                }
+                ImGui::EndMenu();
+            }
+            if (ImGui::MenuItem("Vertical sync", NULL, m_emu->getVSync()))
+            {
+                m_emu->setVSync(!m_emu->getVSync());
+            }
+            if (ImGui::MenuItem("Sync to audio", NULL, m_emu->getAudioSync()))
+            {
+                m_emu->setAudioSync(!m_emu->getAudioSync());
+            }
             ImGui::EndMenu();
         }
         if (ImGui::BeginMenu("Tools"))
@@ -83,8 +167,20 @@ void Gui::renderMenu()
         {
             if (ImGui::MenuItem("Debugger")) { m_renderDebugger = true; }
             if (ImGui::MenuItem("Memory")) { m_renderMemoryEditor = true; }
+#ifdef ZXPP_HEATMAP
+            if (ImGui::MenuItem("Memory heatmap") && !m_renderHeatmap)
+            {
+                // Counts pile up without decaying while the window is closed
+                m_emu->getMemory()->getHeatmap()->clear();
+                m_renderHeatmap = true;
+            }
+#endif
             ImGui::EndMenu();
         }
+        if (Recorder* recorder = m_emu->getRecorder())
+        {
+            ImGui::Text("REC %d frames, %d dropped", recorder->getWrittenFrames(), recorder->getDroppedFrames());
+        }
         ImGui::EndMainMenuBar();
     }
 }
@@ -131,6 +227,48 @@ void Gui::renderLoadRomWindow()
     ImGui::End();
 }
 
+void Gui::renderInsertTapeWindow()
+{
+    ImGui::SetNextWindowSize(ImVec2(400,70), NULL);
+    if (!ImGui::Begin("Insert tape", &m_renderInsertTape, ImGuiWindowFlags_NoResize
+        | ImGuiWindowFlags_NoScrollbar | ImGuiWindowFlags_NoCollapse))
+    {
+        ImGui::End();
+        return;
+    }
+
+    ImGui::PushItemWidth(-50);
+    static char fileStr[260] = "";
+    ImGui::InputText("", fileStr, 260);
+
+    ImGui::SameLine();
+    if (ImGui::SmallButton("..."))
+    {
+        const char* file = noc_file_dialog_open(NOC_FILE_DIALOG_OPEN, "Tape files\0*.tap;*.tzx;*.pzx\0", NULL, NULL);
+        if (file != NULL)
+        {
+            if (strlen(file) < 260)
+            {
+                strcpy(fileStr, file);
+            } else
+            {
+                std::cerr << "File path too long (>260 characters)" << std::endl;
+            }
+        }
+    }
+
+    // LOAD "" reads the blocks from the tape, custom loaders start it playing
+    if (ImGui::Button("Insert"))
+    {
+        m_emu->getTape()->insert(fileStr);
+        m_renderInsertTape = false;
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Cancel")) { m_renderInsertTape = false; }
+
+    ImGui::End();
+}
+
 void Gui::renderDebugger()
 {
     Debugger* debugger = m_emu->getDebugger();
@@ -216,6 +354,34 @@ void Gui::renderDebugger()
     }
     ImGui::PopStyleColor(4);
 
+    // Rewind, restoring a frame pauses the emulation there and resuming
+    // drops the frames recorded after it
+    RewindBuffer* rewind = m_emu->getRewindBuffer();
+    int frameCount = rewind->getFrameCount();
+    int position = rewind->getPosition();
+    ImGui::SameLine();
+    if (ImGui::Button(ICON_FA_BACKWARD) && position > 0)
+    {
+        debugger->breakExecution();
+        m_emu->rewindTo(position - 1);
+    }
+    if (ImGui::IsItemHovered())
+    {
+        ImGui::SetTooltip("Previous frame (hold Backspace to rewind)");
+    }
+    ImGui::SameLine();
+    ImGui::PushItemWidth(200);
+    if (ImGui::SliderInt("##rewind", &position, 0, std::max(frameCount - 1, 0), "frame %.0f")
+        && frameCount > 0)
+    {
+        debugger->breakExecution();
+        m_emu->rewindTo(position);
+    }
+    ImGui::PopItemWidth();
+    ImGui::SameLine();
+    ImGui::Text("-%.2f s, %.1f/%.0f MB", (frameCount - 1 - position) * REFRESH_RATE,
+        rewind->getUsedMemory() / (1024.0 * 1024.0), rewind->getBudget() / (1024.0 * 1024.0));
+
     ImGui::Spacing();
     ImGui::Separator();
     ImGui::Spacing();
@@ -324,6 +490,99 @@ void Gui::renderDebugger()
 
         ImGui::Spacing();
     }
+
+    std::string watchpointsStr = std::string(ICON_FA_EYE) + std::string(" Watchpoints");
+    if (ImGui::CollapsingHeader(watchpointsStr.c_str(), ImGuiTreeNodeFlags_DefaultOpen))
+    {
+        ImGui::Spacing();
+        ImGui::PushStyleColor(ImGuiCol_Button, ImColor::HSV(0.0f, 0.7f, 0.6f));
+        ImGui::PushStyleColor(ImGuiCol_ButtonHovered, ImColor::HSV(0.0f, 0.8f, 0.7f));
+        ImGui::PushStyleColor(ImGuiCol_ButtonActive, ImColor::HSV(0.0f, 0.9f, 0.5f));
+        std::string add = std::string(ICON_FA_PLUS) + std::string(" Add watchpoint");
+        if (ImGui::Button(add.c_str()))
+        {
+            debugger->addWatchpoint({ WatchpointType::WRITE, 0x4000, 0x4000, false });
+        }
+        ImGui::PopStyleColor(3);
+        ImGui::NewLine();
+
+        std::map<int, Watchpoint>* watchpoints = debugger->getWatchpoints();
+        bool changed = false;
+        int removed = -1;
+        for (auto it = watchpoints->begin(); it != watchpoints->end(); ++it)
+        {
+            Watchpoint* wp = &(it->second);
+            ImGui::PushID(it->first);
+            changed |= ImGui::Checkbox(ICON_FA_EYE, &wp->enabled);
+            ImGui::SameLine();
+            const char* types[] = { "Read", "Write", "Change", "IN", "OUT" };
+            ImGui::PushItemWidth(70);
+            changed |= ImGui::Combo("##type", (int*)&wp->type, types, 5);
+            ImGui::PopItemWidth();
+            bool port = (wp->type == WatchpointType::IN || wp->type == WatchpointType::OUT);
+            ImGui::SameLine();
+            ImGui::PushItemWidth(130);
+            int start = wp->start;
+            changed |= ImGui::InputInt(port ? "port" : "from", &start, 1, 100, ImGuiInputTextFlags_CharsHexadecimal);
+            ImGui::SameLine();
+            int end = wp->end;
+            changed |= ImGui::InputInt(port ? "mask" : "to", &end, 1, 100, ImGuiInputTextFlags_CharsHexadecimal);
+            ImGui::PopItemWidth();
+            wp->start = (uint16_t)start;
+            wp->end = (uint16_t)end;
+            ImGui::SameLine();
+            ImGui::PushStyleColor(ImGuiCol_Button, ImColor::HSV(0.0f, 0.7f, 0.6f));
+            ImGui::PushStyleColor(ImGuiCol_ButtonHovered, ImColor::HSV(0.0f, 0.8f, 0.7f));
+            ImGui::PushStyleColor(ImGuiCol_ButtonActive, ImColor::HSV(0.0f, 0.9f, 0.5f));
+            if (ImGui::Button(ICON_FA_TIMES))
+            {
+                removed = it->first;
+            }
+            ImGui::PopStyleColor(3);
+            ImGui::PopID();
+        }
+        if (removed != -1)
+        {
+            debugger->removeWatchpoint(removed);
+        }
+        else if (changed)
+        {
+            debugger->updateWatchpoints();
+        }
+
+        ImGui::Spacing();
+    }
+
+    std::string hitsStr = std::string(ICON_FA_LIST) + std::string(" Watchpoint hits");
+    if (ImGui::CollapsingHeader(hitsStr.c_str(), ImGuiTreeNodeFlags_DefaultOpen))
+    {
+        std::vector<WatchpointHit>* hits = debugger->getWatchpointHits();
+        if (hits->empty())
+        {
+            ImGui::Text("No hits");
+        }
+        else if (ImGui::Button("Clear"))
+        {
+            hits->clear();
+        }
+        const char* types[] = { "read", "write", "change", "in", "out" };
+        ImGui::BeginChild("Hits", ImVec2(0, std::min(hits->size(), (size_t)8) * ImGui::GetTextLineHeightWithSpacing() + 10.0f));
+        for (auto it = hits->rbegin(); it != hits->rend(); ++it)
+        {
+            std::stringstream stream;
+            stream << std::hex << std::setfill('0');
+            stream << "PC " << std::setw(4) << it->pc << " T " << std::dec << it->frameCycleNumber;
+            stream << std::hex << "  " << types[(int)it->type] << " " << std::setw(4) << it->address << ": ";
+            if (it->type == WatchpointType::WRITE || it->type == WatchpointType::CHANGE)
+            {
+                stream << std::setw(2) << +it->oldValue << " -> ";
+            }
+            stream << std::setw(2) << +it->newValue;
+            ImGui::Text(stream.str().c_str());
+        }
+        ImGui::EndChild();
+        ImGui::Spacing();
+    }
     
     std::string registersStr = std::string(ICON_FA_TASKS) + std::string(" Registers");
     SKIPPABLE
@@ -1062,7 +1321,78 @@ void Gui::renderDebugger()
 void Gui::renderMemoryEditor()
 {
     static MemoryEditor memory_editor;
-    memory_editor.Draw("Memory", m_emu->getMemory()->memory, m_emu->getMemory()->size);
+    // Show the address space as seen by the CPU, through the current paging
+    memory_editor.UserData = m_emu->getMemory();
+    memory_editor.ReadFn = [](void* memory, size_t off) -> unsigned char {
+        return ((SpectrumMemory*)memory)->peek((uint16_t)off);
+    };
+    memory_editor.WriteFn = [](void* memory, size_t off, unsigned char d) {
+        ((SpectrumMemory*)memory)->poke((uint16_t)off, d);
+    };
+    memory_editor.Draw("Memory", nullptr, 0x10000);
+}
+
+void Gui::renderHeatmap()
+{
+#ifdef ZXPP_HEATMAP
+    ImGui::SetNextWindowSize(ImVec2(530, 600), ImGuiSetCond_Once);
+    if (!ImGui::Begin("Memory heatmap", &m_renderHeatmap, ImGuiWindowFlags_NoScrollbar))
+    {
+        ImGui::End();
+        return;
+    }
+
+    MemoryHeatmap* heatmap = m_emu->getMemory()->getHeatmap();
+    if (m_heatmapTexture == 0)
+    {
+        glGenTextures(1, &m_heatmapTexture);
+        glLogLastError();
+        glBindTexture(GL_TEXTURE_2D, m_heatmapTexture);
+        glLogLastError();
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glLogLastError();
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glLogLastError();
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 256, 256, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glLogLastError();
+        m_heatmapPixels.resize(HEATMAP_SIZE);
+    }
+    heatmap->render(m_heatmapPixels.data());
+    glBindTexture(GL_TEXTURE_2D, m_heatmapTexture);
+    glLogLastError();
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 256, 256, GL_RGBA, GL_UNSIGNED_BYTE, m_heatmapPixels.data());
+    glLogLastError();
+
+    ImGui::TextColored(ImVec4(1.0f, 0.3f, 0.3f, 1.0f), "write");
+    ImGui::SameLine();
+    ImGui::TextColored(ImVec4(0.3f, 1.0f, 0.3f, 1.0f), "read");
+    ImGui::SameLine();
+    ImGui::TextColored(ImVec4(0.4f, 0.4f, 1.0f, 1.0f), "execute");
+    ImGui::SameLine();
+    ImGui::Text("(one row per 256 bytes)");
+    if (ImGui::Button("Clear"))
+    {
+        heatmap->clear();
+    }
+
+    ImVec2 origin = ImGui::GetCursorScreenPos();
+    ImGui::Image((void *)(intptr_t)m_heatmapTexture, ImVec2(512, 512));
+    if (ImGui::IsItemHovered())
+    {
+        ImVec2 mouse = ImGui::GetMousePos();
+        int x = std::min(std::max((int)((mouse.x - origin.x) / 2.0f), 0), 255);
+        int y = std::min(std::max((int)((mouse.y - origin.y) / 2.0f), 0), 255);
+        int address = y * 256 + x;
+        std::stringstream stream;
+        stream << std::hex << std::setw(4) << std::setfill('0') << address << std::dec
+            << "\nreads " << heatmap->reads[address]
+            << "\nwrites " << heatmap->writes[address]
+            << "\nexecutes " << heatmap->executes[address];
+        ImGui::SetTooltip(stream.str().c_str());
+    }
+
+    ImGui::End();
+#endif
 }
 
 void Gui::uploadTextures()
@@ -1185,3 +1515,8 @@ std::vector<std::string>* Gui::getVirtualKeyboardPressedKeys()
 {
     return &m_virtualKeyboardPressedKeys;
 }
+
+bool Gui::isHeatmapOpen()
+{
+    return m_renderHeatmap;
+}
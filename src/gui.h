@@ -82,23 +82,30 @@ class Gui {
         void handleInput(SDL_Event &e);
 
         std::vector<std::string>* getVirtualKeyboardPressedKeys();
+        bool isHeatmapOpen();
     protected:
         void uploadTextures();
 
         void renderMenu();
         void renderLoadRomWindow();
+        void renderInsertTapeWindow();
         void renderDebugger();
         void renderMemoryEditor();
+        void renderHeatmap();
         void renderVirtualKeyboard();
     private:
         bool m_renderMenu;
         bool m_renderLoadROM;
+        bool m_renderInsertTape;
         bool m_renderDebugger;
         bool m_renderMemoryEditor;
         bool m_renderVirtualKeyboard;
+        bool m_renderHeatmap;
 
         Emulator* m_emu;
         std::map<std::string, GLuint> m_textureIDs;
+        GLuint m_heatmapTexture;
+        std::vector<uint32_t> m_heatmapPixels;
 
         std::vector<std::string> m_virtualKeyboardPressedKeys;
 };
\ No newline at end of file
@@ -0,0 +1,39 @@
+#include "heatmap.h"
+
+#include <cstring>
+
+void MemoryHeatmap::clear()
+{
+    memset(reads, 0, sizeof(reads));
+    memset(writes, 0, sizeof(writes));
+    memset(executes, 0, sizeof(executes));
+}
+
+void MemoryHeatmap::decay()
+{
+    for (int i = 0; i < HEATMAP_SIZE; i++)
+    {
+        reads[i] -= reads[i] >> HEATMAP_DECAY_SHIFT;
+        writes[i] -= writes[i] >> HEATMAP_DECAY_SHIFT;
+        executes[i] -= executes[i] >> HEATMAP_DECAY_SHIFT;
+    }
+}
+
+// Logarithmic scale, so that single accesses are still visible next to loops
+static inline uint32_t intensity(uint32_t count)
+{
+    int bits = 0;
+    while (count) { bits++; count >>= 1; }
+    int value = bits * 16;
+    return value > 255 ? 255 : value;
+}
+
+void MemoryHeatmap::render(uint32_t* pixels) const
+{
+    for (int i = 0; i < HEATMAP_SIZE; i++)
+    {
+        // Bytes in memory are R, G, B, A
+        pixels[i] = intensity(writes[i]) | (intensity(reads[i]) << 8)
+            | (intensity(executes[i]) << 16) | 0xFF000000;
+    }
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "defines.h"
+
+#include <stdint.h>
+
+#define HEATMAP_SIZE 0x10000
+#define HEATMAP_DECAY_SHIFT 3       // Counters lose 1/8 of their value every frame
+
+// Memory accesses per address of the CPU address space. Counters decay every
+// frame, so they show roughly the recent accesses per frame
+struct MemoryHeatmap {
+    uint32_t reads[HEATMAP_SIZE];
+    uint32_t writes[HEATMAP_SIZE];
+    uint32_t executes[HEATMAP_SIZE];
+    uint32_t counting;              // 1, 0 while frames that are not shown run (run-ahead)
+
+    MemoryHeatmap() : counting(1) { clear(); }
+
+    void clear();
+    void decay();
+
+    // 256x256 RGBA image, one pixel per address (row = high byte):
+    // red = writes, green = reads, blue = executed instructions
+    void render(uint32_t* pixels) const;
+};
+
+// Counting is compiled in only with ZXPP_HEATMAP, see defines.h
+#ifdef ZXPP_HEATMAP
+    // Adding counting keeps the accesses free of branches
+    #define HEATMAP_READ(heatmap, address) ((heatmap)->reads[(address)] += (heatmap)->counting)
+    #define HEATMAP_WRITE(heatmap, address) ((heatmap)->writes[(address)] += (heatmap)->counting)
+    #define HEATMAP_EXECUTE(heatmap, address) ((heatmap)->executes[(address)] += (heatmap)->counting)
+#else
+    #define HEATMAP_READ(heatmap, address) ((void)0)
+    #define HEATMAP_WRITE(heatmap, address) ((void)0)
+    #define HEATMAP_EXECUTE(heatmap, address) ((void)0)
+#endif
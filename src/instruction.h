@@ -24,7 +24,7 @@ struct Instruction {
     int numDataBytes;           // Number of data bytes after the instrution
 
     // Execute this instruction
-    void (*execute)(Z80*, Spectrum48KMemory*, std::vector<uint8_t>);
+    void (*execute)(Z80*, SpectrumMemory*, std::vector<uint8_t>);
 
     int cntMachineCycles;       // Number of machine cycles
 
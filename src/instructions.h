@@ -37,7 +37,7 @@ struct hash<opcode>{
 }
 
 // Instruction lambda signature
-#define INST [](Z80* z, Spectrum48KMemory* m, std::vector<uint8_t> d)
+#define INST [](Z80* z, SpectrumMemory* m, std::vector<uint8_t> d)
 
 // Create the instruction set
 std::shared_ptr<std::array<Instruction, NUM_INSTRUCTIONS>> z80InstructionSet();
@@ -37,23 +37,25 @@ std::string Keyboard::getKeyStringFromKeycode(SDL_Keycode k)
     return std::string("ZX_UNKNOWN");
 }
 
-Keyboard::Keyboard(Emulator* emu, Gui* gui)
+Keyboard::Keyboard(Emulator* emu)
 {
     m_emu = emu;
-    m_gui = gui;
 }
 
-void Keyboard::receiveData(uint8_t data, uint16_t port)
+void Keyboard::receiveData(uint8_t data, uint16_t port, int tState)
 {
 
 }
 
-bool Keyboard::sendData(uint8_t& out, uint16_t port)
+bool Keyboard::sendData(uint8_t& out, uint16_t port, int tState)
 {
     std::vector<SDL_Keycode>* keys = m_emu->getPressedKeys();
-    std::vector<std::string>* virtualKeys = m_gui->getVirtualKeyboardPressedKeys();
+    // There is no virtual keyboard without a window
+    static std::vector<std::string> noVirtualKeys;
+    Gui* gui = m_emu->getGui();
+    std::vector<std::string>* virtualKeys = gui ? gui->getVirtualKeyboardPressedKeys() : &noVirtualKeys;
     
-    out = 0x1F; // TODO: change (to 0xFF?) when upper 3 bits of 0xFE port are implemented
+    out = 0xFF; // Bits 5 and 7 read 1, bit 6 (EAR) is pulled low by the tape
     if ((port & 0x01) == 0)     // Port 0xFE
     {
         for (int m = 0; m < 8; m++)
@@ -15,10 +15,10 @@ class Emulator;
 
 class Keyboard : IDevice {
     public:
-        Keyboard(Emulator* emu, Gui* gui);
+        Keyboard(Emulator* emu);
 
-        virtual void receiveData(uint8_t data, uint16_t port) override;
-        virtual bool sendData(uint8_t& out, uint16_t port) override;
+        virtual void receiveData(uint8_t data, uint16_t port, int tState) override;
+        virtual bool sendData(uint8_t& out, uint16_t port, int tState) override;
 
         // Map keycode to each keyboard key to m x n array
         // m determines the "row", 0 being the A8 (CAPS-V)
@@ -31,6 +31,5 @@ class Keyboard : IDevice {
         static std::string getKeyStringFromKeycode(SDL_Keycode k);
     private:
         Emulator* m_emu;
-        Gui* m_gui;
 
 };
\ No newline at end of file
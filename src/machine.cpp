@@ -0,0 +1,15 @@
+#include "machine.h"
+
+const MachineModel& getMachineModel(MachineType type)
+{
+    // http://www.worldofspectrum.org/faq/reference/48kreference.htm
+    // http://www.worldofspectrum.org/faq/reference/128kreference.htm
+    static const MachineModel models[] = {
+        { MachineType::SPECTRUM_48K, "ZX Spectrum 48K", "48.rom",
+          3500000.0, 69888, 224, 64, 1, false, false },
+        { MachineType::SPECTRUM_128K, "ZX Spectrum 128K", "128.rom",
+          3546900.0, 70908, 228, 63, 2, true, true }
+    };
+
+    return models[static_cast<int>(type)];
+}
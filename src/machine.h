@@ -0,0 +1,23 @@
+#pragma once
+
+#include <string>
+
+enum class MachineType { SPECTRUM_48K = 0, SPECTRUM_128K = 1 };
+
+// Timing and memory configuration of an emulated machine
+struct MachineModel {
+    MachineType type;
+    std::string name;
+    std::string defaultROM;     // ROM image loaded when none is specified
+
+    double clockFrequency;      // CPU clock in Hz
+    int tStatesPerFrame;        // Length of one frame (between two interrupts)
+    int tStatesPerLine;         // Length of one scanline
+    int firstDisplayLine;       // Scanline with the first line of the screen bitmap
+
+    int numROMs;                // Number of 16 KB ROM banks
+    bool hasPaging;             // Memory paging through port 0x7FFD
+    bool hasAY;                 // AY-3-8912 sound chip on ports 0xFFFD and 0xBFFD
+};
+
+const MachineModel& getMachineModel(MachineType type);
@@ -17,6 +17,7 @@
 #include "gui.h"
 #include "emulator.h"
 #include "tests/z80_tests.h"
+#include "tests/frame_tests.h"
 
 #include <fstream>
 #include <random>
@@ -38,6 +39,108 @@ int main(int argc, char* args[])
 {
     static bool showImguiDemo = false;
 
+    std::string file = "";
+    std::string tape = "";
+    MachineType machineType = MachineType::SPECTRUM_48K;
+    int headlessFrames = 0;
+    std::string frameTests = "";
+    bool captureEnabled = false;
+    CaptureSettings capture;
+    capture.output = "";
+    capture.interval = 1;
+    RecordSettings record;
+    record.video = "";
+    bool vsync = true;
+    bool audioSync = true;
+    int runAhead = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg(args[i]);
+        bool hasValue = (i + 1 < argc);
+        if (arg == "-128") { machineType = MachineType::SPECTRUM_128K; }
+        else if (arg == "-48") { machineType = MachineType::SPECTRUM_48K; }
+        else if (arg == "-headless" && hasValue) { headlessFrames = std::stoi(args[++i]); }
+        else if (arg == "-frametests" && hasValue) { frameTests = args[++i]; }
+        else if (arg == "-capture" && hasValue)
+        {
+            captureEnabled = true;
+            capture.format = (std::string(args[++i]) == "raw") ? CaptureFormat::RAW : CaptureFormat::PNG;
+        }
+        else if (arg == "-capture-every" && hasValue) { capture.interval = std::stoi(args[++i]); }
+        else if (arg == "-capture-out" && hasValue) { capture.output = args[++i]; }
+        else if (arg == "-record" && hasValue)
+        {
+            record.video = args[++i];
+            bool raw = record.video.size() >= 4 && record.video.substr(record.video.size() - 4) == ".raw";
+            record.format = raw ? RecordFormat::RAW : RecordFormat::Y4M;
+        }
+        else if (arg == "-record-audio" && hasValue) { record.audio = args[++i]; }
+        else if (arg == "-novsync") { vsync = false; }
+        else if (arg == "-noaudiosync") { audioSync = false; }
+        else if (arg == "-runahead" && hasValue) { runAhead = std::stoi(args[++i]); }
+        else if (arg == "-tape" && hasValue) { tape = args[++i]; }
+        else { file = arg; }
+    }
+    if (file.empty())
+    {
+        file = getMachineModel(machineType).defaultROM;
+    }
+    if (capture.output.empty())
+    {
+        capture.output = (capture.format == CaptureFormat::RAW) ? "-" : "frame_";
+    }
+
+    // Golden frame tests, the exit code is the number of failed checks
+    if (!frameTests.empty())
+    {
+        FrameTester frameTester;
+        if (!frameTester.parseTestFile(frameTests))
+        {
+            return -1;
+        }
+        return frameTester.runTests();
+    }
+
+    // Batch run without window or OpenGL, e.g.
+    // zxpp -headless 500 -capture raw | ffmpeg -f rawvideo -pix_fmt rgb24 -s 352x296 -r 3500000/69888 -i - out.mp4
+    if (headlessFrames > 0)
+    {
+        // Raw frames may go to stdout, keep it clean
+        std::cout.rdbuf(std::cerr.rdbuf());
+
+        Emulator emu(nullptr);
+        emu.setMachineType(machineType);
+        emu.loadROM(file);
+        if (!tape.empty() && !emu.getTape()->insert(tape))
+        {
+            return -1;
+        }
+        if (captureEnabled)
+        {
+            emu.setCapture(capture);
+        }
+        // Nothing waits for the frames, so the writer may slow the run
+        // down instead of losing them
+        record.dropFrames = false;
+        if (!record.video.empty() && !emu.startRecording(record))
+        {
+            return -1;
+        }
+        emu.runHeadless(headlessFrames);
+        if (captureEnabled)
+        {
+            std::cerr << "Captured " << emu.getCapture()->getCapturedFrames() << " frames, "
+                << emu.getCapture()->getFailedFrames() << " failed" << std::endl;
+        }
+        if (emu.getRecorder() != nullptr)
+        {
+            std::cerr << "Recorded " << emu.getRecorder()->getWrittenFrames() << " frames, "
+                << emu.getRecorder()->getDroppedFrames() << " dropped" << std::endl;
+        }
+        return 0;
+    }
+
     SDL_Window* window = createWindow(800, 600, "ZX++");
     if (window == nullptr)
 	{
@@ -46,6 +149,8 @@ int main(int argc, char* args[])
 
     Emulator emu(window);
     ImGui_ImplSdlGL3_Init(window);
+    emu.setVSync(vsync);
+    emu.setAudioSync(audioSync);
 
 
     // Redirect cerr to log file
@@ -64,21 +169,32 @@ int main(int argc, char* args[])
     // TODO: debugger: debugger pise nesmyslny raw bytes a adresa (i dosazeny data instrukce?)
     // po skoku (u ty instrukce skoku, returnu,...)
 
-    std::string file = "48.rom";
-
-    if (argc > 1)
+    emu.setMachineType(machineType);
+    emu.loadROM(file);
+    if (!tape.empty())
     {
-        file = std::string(args[1]);
+        emu.getTape()->insert(tape);
     }
-    
-    emu.loadROM(file);
+    if (captureEnabled)
+    {
+        emu.setCapture(capture);
+    }
+    if (!record.video.empty())
+    {
+        emu.startRecording(record);
+    }
+    emu.setRunAhead(runAhead);
+    emu.start();
 
     // Main loop
 	bool quit = false;
+    bool minimized = false;
     SDL_Event e;
     while (!quit)
     {
-        while (SDL_PollEvent(&e))
+        // Sleep until there is input or a new frame instead of polling
+        bool hasEvent = SDL_WaitEventTimeout(&e, emu.getEventTimeout()) != 0;
+        for (; hasEvent; hasEvent = SDL_PollEvent(&e) != 0)
         {
             ImGui_ImplSdlGL3_ProcessEvent(&e);
             emu.processEvent(e);
@@ -96,6 +212,12 @@ int main(int argc, char* args[])
                         SDL_GetWindowSize(window, &w, &h);
                         glViewport(0, 0, w, h);
                         break;
+                    case SDL_WINDOWEVENT_MINIMIZED:
+                        minimized = true;
+                        break;
+                    case SDL_WINDOWEVENT_RESTORED:
+                        minimized = false;
+                        break;
                 }
             }
             if (e.type == SDL_KEYDOWN)
@@ -107,11 +229,13 @@ int main(int argc, char* args[])
             }
         }
 
-        if (emu.loop())
+        // Nothing is drawn while minimized, frame events stop until loop() runs again
+        if (!minimized && emu.loop())
         {
 
             std::stringstream stream;
-            stream << std::fixed << std::setprecision(1) << 1.0f/(float)emu.getDeltaTime();
+            stream << std::fixed << std::setprecision(1) << 1.0f/(float)emu.getDeltaTime()
+                << " | Speed: " << emu.getMeasuredSpeed() << "x";
             std::string fps = stream.str();
             fps = "ZXPP | FPS: " + fps;
             SDL_SetWindowTitle(window, fps.c_str());
@@ -128,6 +252,7 @@ int main(int argc, char* args[])
 
     }
 
+    emu.stop();
     SDL_DestroyWindow(window);
     SDL_Quit();
 
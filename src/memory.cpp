@@ -0,0 +1,287 @@
+#include "memory.h"
+
+#include <algorithm>
+#include <cstring>
+#include <assert.h>
+
+SpectrumMemory::SpectrumMemory(MachineType type)
+    : m_type(type),
+      m_writeProtectROM(true),
+      m_pagingRegister(0),
+      m_discard(MEMORY_PAGE_SIZE, 0),
+      m_watcher(nullptr),
+      m_screenListener(nullptr)
+{
+    for (uint8_t& flags : m_watchFlags) { flags = 0; }
+#ifdef ZXPP_HEATMAP
+    m_heatmap.reset(new MemoryHeatmap());
+#endif
+    for (int i = 0; i < MEMORY_PAGES; i++)
+    {
+        m_pages[i] = std::make_shared<MemoryPage>();
+        m_pageData[i] = m_pages[i]->data;
+        m_pageShared[i] = false;
+    }
+
+    updatePageTable();
+}
+
+void SpectrumMemory::setMachineType(MachineType type)
+{
+    m_type = type;
+    resetPaging();
+}
+
+MachineType SpectrumMemory::getMachineType()
+{
+    return m_type;
+}
+
+void SpectrumMemory::poke(uint16_t address, uint8_t value)
+{
+    writeSlow(address, value, true);
+}
+
+void SpectrumMemory::writeSlow(uint16_t address, uint8_t value, bool poke)
+{
+    int page = address >> MEMORY_PAGE_SHIFT;
+    if (poke || (m_pageFlags[page] & PAGE_FLAG_SHARED))
+    {
+        unsharePage(m_pageIndex[page]);
+    }
+
+    uint8_t* byte = poke ? &m_readMap[page][address & MEMORY_PAGE_MASK]
+                         : &m_writeMap[page][address & MEMORY_PAGE_MASK];
+    if (!poke && (m_pageFlags[page] & PAGE_FLAG_WATCH_WRITE))
+    {
+        // Writes to ROM are reported too, with the value the CPU tried to write
+        m_watcher->memoryWritten(address, m_readMap[page][address & MEMORY_PAGE_MASK], value);
+    }
+    if ((m_pageFlags[page] & PAGE_FLAG_SCREEN) && *byte != value)
+    {
+        // Banks are mapped on 16 KB boundaries, so the offset in the bank
+        // is given by the lowest 14 bits of the address
+        uint16_t offset = address & (MEMORY_BANK_SIZE - 1);
+        if (!poke && m_screenListener && offset < SCREEN_SIZE
+            && m_pageDirtyMap[page] == getScreenDirtyMap())
+        {
+            m_screenListener->screenChanging(offset);
+        }
+        if (offset < SCREEN_BITMAP_SIZE)
+        {
+            // Third of the screen and character row are bits 11-12 and 5-7
+            m_pageDirtyMap[page]->markCell(((offset >> 3) & 0x300) | (offset & 0xFF));
+        }
+        else if (offset < SCREEN_SIZE)
+        {
+            m_pageDirtyMap[page]->markCell(offset - SCREEN_BITMAP_SIZE);
+        }
+    }
+    *byte = value;
+}
+
+void SpectrumMemory::unsharePage(int index)
+{
+    if (!m_pageShared[index]) { return; }
+
+    // The snapshots may have been released since
+    if (m_pages[index].use_count() > 1)
+    {
+        m_pages[index] = std::make_shared<MemoryPage>(*m_pages[index]);
+        m_pageData[index] = m_pages[index]->data;
+    }
+    m_pageShared[index] = false;
+    updatePageTable();
+}
+
+size_t SpectrumMemory::loadROM(int bank, const uint8_t* data, size_t size)
+{
+    assert(bank >= 0 && bank < ROM_BANKS);
+    size = std::min(size, (size_t)MEMORY_BANK_SIZE);
+    for (int page = 0; page < PAGES_PER_BANK; page++)
+    {
+        unsharePage(romPageIndex(bank, page));
+    }
+    for (size_t i = 0; i < size; i++)
+    {
+        m_pageData[romPageIndex(bank, (int)(i >> MEMORY_PAGE_SHIFT))][i & MEMORY_PAGE_MASK] = data[i];
+    }
+    return size;
+}
+
+void SpectrumMemory::setROMWriteProtect(bool protect)
+{
+    m_writeProtectROM = protect;
+    updatePageTable();
+}
+
+void SpectrumMemory::setPagingRegister(uint8_t value)
+{
+    if (m_type != MachineType::SPECTRUM_128K || isPagingLocked()) { return; }
+    bool screenChanged = (m_pagingRegister ^ value) & 0x08;
+    if (screenChanged && m_screenListener)
+    {
+        m_screenListener->screenChanging(-1);
+    }
+    m_pagingRegister = value;
+    updatePageTable();
+    if (screenChanged)
+    {
+        getScreenDirtyMap()->markAll();
+    }
+}
+
+uint8_t SpectrumMemory::getPagingRegister()
+{
+    return m_pagingRegister;
+}
+
+bool SpectrumMemory::isPagingLocked()
+{
+    return (m_pagingRegister & 0x20) != 0;
+}
+
+void SpectrumMemory::resetPaging()
+{
+    m_pagingRegister = 0;
+    updatePageTable();
+    getScreenDirtyMap()->markAll();
+}
+
+int SpectrumMemory::getPagedBank()
+{
+    return m_pagingRegister & 0x07;
+}
+
+int SpectrumMemory::getScreenBank()
+{
+    return (m_pagingRegister & 0x08) ? 7 : 5;
+}
+
+uint8_t* const* SpectrumMemory::getScreenPages()
+{
+    return getBankPages(getScreenBank());
+}
+
+uint8_t* const* SpectrumMemory::getBankPages(int bank)
+{
+    assert(bank >= 0 && bank < RAM_BANKS);
+    return &m_pageData[ramPageIndex(bank, 0)];
+}
+
+ScreenDirtyMap* SpectrumMemory::getScreenDirtyMap()
+{
+    return &m_screenDirty[getScreenBank() == 7 ? 1 : 0];
+}
+
+void SpectrumMemory::saveSnapshot(MemorySnapshot& snapshot)
+{
+    snapshot.type = m_type;
+    snapshot.pagingRegister = m_pagingRegister;
+    for (int i = 0; i < MEMORY_PAGES; i++)
+    {
+        snapshot.pages[i] = m_pages[i];
+        m_pageShared[i] = true;
+    }
+    updatePageTable();
+}
+
+void SpectrumMemory::loadSnapshot(const MemorySnapshot& snapshot)
+{
+    m_type = snapshot.type;
+    m_pagingRegister = snapshot.pagingRegister;
+    for (int i = 0; i < MEMORY_PAGES; i++)
+    {
+        // Pages stay shared with the snapshot, so they are copied before
+        // being written to and the snapshot itself never changes
+        m_pages[i] = std::const_pointer_cast<MemoryPage>(snapshot.pages[i]);
+        m_pageData[i] = m_pages[i]->data;
+        m_pageShared[i] = true;
+    }
+    updatePageTable();
+    m_screenDirty[0].markAll();
+    m_screenDirty[1].markAll();
+}
+
+void SpectrumMemory::setWatcher(MemoryWatcher* watcher)
+{
+    m_watcher = watcher;
+}
+
+void SpectrumMemory::setScreenListener(ScreenListener* listener)
+{
+    m_screenListener = listener;
+}
+
+void SpectrumMemory::setWatchFlags(int page, uint8_t flags)
+{
+    assert(page >= 0 && page < ADDRESS_SPACE_PAGES);
+    m_watchFlags[page] = m_watcher ? flags : 0;
+    updatePageTable();
+}
+
+#ifdef ZXPP_HEATMAP
+MemoryHeatmap* SpectrumMemory::getHeatmap()
+{
+    return m_heatmap.get();
+}
+#endif
+
+void SpectrumMemory::updatePageTable()
+{
+    // 0x0000 ROM, 0x4000 bank 5, 0x8000 bank 2, 0xC000 bank 0 (selectable on 128K)
+    int rom = (m_pagingRegister & 0x10) ? 1 : 0;
+    int slots[3] = { 5, 2, getPagedBank() };
+
+    for (int page = 0; page < PAGES_PER_BANK; page++)
+    {
+        int index = romPageIndex(rom, page);
+        m_pageIndex[page] = index;
+        m_readMap[page] = m_pageData[index];
+        m_writeMap[page] = m_writeProtectROM ? m_discard.data() : m_pageData[index];
+        m_pageFlags[page] = (!m_writeProtectROM && m_pageShared[index]) ? PAGE_FLAG_SHARED : 0;
+        m_pageDirtyMap[page] = nullptr;
+        for (int slot = 0; slot < 3; slot++)
+        {
+            int i = (slot + 1) * PAGES_PER_BANK + page;
+            int bank = slots[slot];
+            index = ramPageIndex(bank, page);
+            m_pageIndex[i] = index;
+            m_readMap[i] = m_pageData[index];
+            m_writeMap[i] = m_pageData[index];
+            m_pageFlags[i] = m_pageShared[index] ? PAGE_FLAG_SHARED : 0;
+            m_pageDirtyMap[i] = nullptr;
+
+            // Screen memory takes the first two pages of banks 5 and 7
+            if ((bank == 5 || bank == 7) && page * MEMORY_PAGE_SIZE < SCREEN_SIZE)
+            {
+                m_pageFlags[i] |= PAGE_FLAG_SCREEN;
+                m_pageDirtyMap[i] = &m_screenDirty[bank == 7 ? 1 : 0];
+            }
+        }
+    }
+
+    // Watchpoints are on CPU addresses and stay in place when paging
+    for (int page = 0; page < ADDRESS_SPACE_PAGES; page++)
+    {
+        m_pageFlags[page] |= m_watchFlags[page];
+    }
+}
+
+PagingDevice::PagingDevice(SpectrumMemory* memory)
+    : m_memory(memory)
+{}
+
+void PagingDevice::receiveData(uint8_t data, uint16_t port, int tState)
+{
+    // Port 0x7FFD is decoded by A15 and A1 reset
+    if ((port & 0x8002) == 0)
+    {
+        m_memory->setPagingRegister(data);
+    }
+}
+
+bool PagingDevice::sendData(uint8_t& out, uint16_t port, int tState)
+{
+    return false;
+}
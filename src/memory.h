@@ -2,43 +2,278 @@
 #define MEMORY_H
 
 #include <stdint.h>
+#include <vector>
+#include <memory>
 
-struct Spectrum48KMemory {
-    uint8_t memory[0xFFFF];
-
-    uint8_t* ROM = &memory[0x0000];
-    uint8_t* screenMemory = &memory[0x4000];
-    uint8_t* screenColorData = &memory[0x5800];
-    uint8_t* printerBuffer = &memory[0x5B00];
-    uint8_t* systemVariables = &memory[0x5C00];
-    uint8_t* userMemory = &memory[0x5CCB];
-
-    uint16_t ROM_size = 0x4000;
-    uint16_t screen_size = 0x17FF;
-    uint16_t screenColor_size = 0x02FF;
-    uint16_t printerBuffer_size = 0x00FF;
-    uint16_t systemVariables_size = 0x00BF;
-    uint16_t userMemory_size = 0xA28C;
-    uint16_t size = 0xFFFF;
-
-    inline uint8_t& operator[](uint16_t i)
+#include "machine.h"
+#include "devices.h"
+#include "heatmap.h"
+
+// Physical memory is split into 4 KB pages, the 64 KB address space of the CPU
+// is mapped onto them through a page table, so paging only swaps pointers
+#define MEMORY_PAGE_SHIFT 12
+#define MEMORY_PAGE_SIZE (1 << MEMORY_PAGE_SHIFT)
+#define MEMORY_PAGE_MASK (MEMORY_PAGE_SIZE - 1)
+#define ADDRESS_SPACE_PAGES (0x10000 / MEMORY_PAGE_SIZE)
+
+#define MEMORY_BANK_SIZE 0x4000
+#define PAGES_PER_BANK (MEMORY_BANK_SIZE / MEMORY_PAGE_SIZE)
+#define RAM_BANKS 8
+#define ROM_BANKS 2
+#define MEMORY_PAGES ((RAM_BANKS + ROM_BANKS) * PAGES_PER_BANK)
+
+// Screen bitmap and attributes, relative to the start of a screen bank
+#define SCREEN_BITMAP_SIZE 0x1800
+#define SCREEN_ATTRIBUTES_SIZE 0x0300
+#define SCREEN_SIZE (SCREEN_BITMAP_SIZE + SCREEN_ATTRIBUTES_SIZE)
+#define SCREEN_CELLS SCREEN_ATTRIBUTES_SIZE     // 32 x 24 character cells
+
+// Flags of the address space pages, writes to flagged pages take the slow path
+#define PAGE_FLAG_SCREEN 0x01       // Page holds screen memory, track dirty cells
+#define PAGE_FLAG_SHARED 0x02       // Page is referenced by a snapshot, copy on write
+#define PAGE_FLAG_WATCH_READ 0x04   // Page has read watchpoints
+#define PAGE_FLAG_WATCH_WRITE 0x08  // Page has write watchpoints
+#define PAGE_FLAGS_WRITE_SLOW (PAGE_FLAG_SCREEN | PAGE_FLAG_SHARED | PAGE_FLAG_WATCH_WRITE)
+
+// Notified of CPU accesses to pages flagged by SpectrumMemory::setWatchFlags,
+// the address still has to be checked against the watched ranges
+class MemoryWatcher {
+    public:
+        virtual void memoryRead(uint16_t address, uint8_t value) = 0;
+        virtual void memoryWritten(uint16_t address, uint8_t oldValue, uint8_t newValue) = 0;
+};
+
+// Notified before the CPU changes what the ULA displays, offset is relative
+// to the start of the screen bank or -1 when the displayed bank is switched
+class ScreenListener {
+    public:
+        virtual void screenChanging(int offset) = 0;
+};
+
+struct MemoryPage {
+    uint8_t data[MEMORY_PAGE_SIZE];
+};
+
+// Contents of the memory at some point in time. Pages are shared with the
+// memory and copied only when it writes to them after the snapshot was taken
+struct MemorySnapshot {
+    MachineType type;
+    uint8_t pagingRegister;
+    std::shared_ptr<const MemoryPage> pages[MEMORY_PAGES];
+};
+
+// Character cells of a screen bank that changed since the display last drew it
+struct ScreenDirtyMap {
+    uint64_t cells[SCREEN_CELLS / 64];
+    bool any;
+
+    ScreenDirtyMap() { markAll(); }
+
+    inline void markCell(int cell)
+    {
+        cells[cell >> 6] |= (uint64_t)1 << (cell & 63);
+        any = true;
+    }
+
+    inline bool isDirty(int cell) const
+    {
+        return (cells[cell >> 6] >> (cell & 63)) & 1;
+    }
+
+    void markAll()
     {
-        return memory[i];
+        for (uint64_t& c : cells) { c = ~(uint64_t)0; }
+        any = true;
     }
 
-    inline const uint8_t& operator[](uint16_t i) const
+    void clear()
     {
-        return memory[i];
+        for (uint64_t& c : cells) { c = 0; }
+        any = false;
     }
+};
+
+class SpectrumMemory;
+
+// Reference to a single byte of the address space, returned by
+// SpectrumMemory::operator[] so that every write goes through the page table
+class MemoryCell {
+    public:
+        MemoryCell(SpectrumMemory* memory, uint16_t address)
+            : m_memory(memory), m_address(address) {}
+
+        inline operator uint8_t() const;
+        inline MemoryCell& operator=(uint8_t value);
+
+        // Assigning one cell to another copies the value, not the reference
+        inline MemoryCell& operator=(const MemoryCell& other) { return *this = (uint8_t)other; }
+
+        inline MemoryCell& operator|=(uint8_t value) { return *this = (uint8_t)(*this | value); }
+        inline MemoryCell& operator&=(uint8_t value) { return *this = (uint8_t)(*this & value); }
+        inline MemoryCell& operator^=(uint8_t value) { return *this = (uint8_t)(*this ^ value); }
+    private:
+        SpectrumMemory* m_memory;
+        uint16_t m_address;
+};
+
+class SpectrumMemory {
+    public:
+        SpectrumMemory(MachineType type = MachineType::SPECTRUM_48K);
+        SpectrumMemory(const SpectrumMemory&) = delete;
+        SpectrumMemory& operator=(const SpectrumMemory&) = delete;
+
+        // Change the memory configuration, resets paging
+        void setMachineType(MachineType type);
+        MachineType getMachineType();
+
+        // Memory access by the CPU
+        inline uint8_t read(uint16_t address)
+        {
+            int page = address >> MEMORY_PAGE_SHIFT;
+            uint8_t value = m_readMap[page][address & MEMORY_PAGE_MASK];
+            HEATMAP_READ(m_heatmap, address);
+            if (m_pageFlags[page] & PAGE_FLAG_WATCH_READ)
+            {
+                m_watcher->memoryRead(address, value);
+            }
+            return value;
+        }
+
+        // Read without side effects, used by instruction fetch, the debugger and the GUI
+        inline uint8_t peek(uint16_t address) const
+        {
+            return m_readMap[address >> MEMORY_PAGE_SHIFT][address & MEMORY_PAGE_MASK];
+        }
+
+        // Writes to ROM end up in a scratch page and are lost
+        inline void write(uint16_t address, uint8_t value)
+        {
+            int page = address >> MEMORY_PAGE_SHIFT;
+            HEATMAP_WRITE(m_heatmap, address);
+            if (m_pageFlags[page] & PAGE_FLAGS_WRITE_SLOW)
+            {
+                writeSlow(address, value, false);
+                return;
+            }
+            m_writeMap[page][address & MEMORY_PAGE_MASK] = value;
+        }
+
+        // Write ignoring the ROM protection, used by loaders and the memory editor
+        void poke(uint16_t address, uint8_t value);
+
+        inline MemoryCell operator[](uint16_t i)
+        {
+            return MemoryCell(this, i);
+        }
+
+        inline uint8_t operator[](uint16_t i) const
+        {
+            return peek(i);
+        }
+
+        // Copy ROM image into the ROM bank, returns number of bytes used
+        size_t loadROM(int bank, const uint8_t* data, size_t size);
+
+        // Allow writes to ROM, the CPU tests expect 64 KB of RAM
+        void setROMWriteProtect(bool protect);
+
+        // Value written to port 0x7FFD on the 128K
+        // bits 0-2: RAM bank at 0xC000, bit 3: shadow screen (bank 7),
+        // bit 4: ROM select, bit 5: disable paging until reset
+        void setPagingRegister(uint8_t value);
+        uint8_t getPagingRegister();
+        bool isPagingLocked();
+        void resetPaging();
+
+        // RAM bank mapped at 0xC000
+        int getPagedBank();
+        // RAM bank the ULA currently displays (5 or 7)
+        int getScreenBank();
+
+        // Pages of the RAM bank displayed by the ULA, read directly by the display
+        uint8_t* const* getScreenPages();
+        uint8_t* const* getBankPages(int bank);
+
+        // Cells of the displayed screen written since the last call to clear()
+        ScreenDirtyMap* getScreenDirtyMap();
+
+        // Snapshots only copy page references, taking and restoring one is
+        // O(number of pages)
+        void saveSnapshot(MemorySnapshot& snapshot);
+        void loadSnapshot(const MemorySnapshot& snapshot);
+
+        // Watch CPU accesses to an address space page (PAGE_FLAG_WATCH_*)
+        void setWatcher(MemoryWatcher* watcher);
+        void setWatchFlags(int page, uint8_t flags);
+
+        void setScreenListener(ScreenListener* listener);
+
+#ifdef ZXPP_HEATMAP
+        // CPU accesses per address, instruction fetches are counted by the CPU
+        MemoryHeatmap* getHeatmap();
+#endif
+    protected:
+        // Rebuild the page table from the paging register
+        void updatePageTable();
+
+        // Write to a flagged page, poke ignores the ROM protection
+        void writeSlow(uint16_t address, uint8_t value, bool poke);
+
+        // Copy a page referenced by a snapshot before it is written to
+        void unsharePage(int index);
+
+        inline int ramPageIndex(int bank, int page) { return bank * PAGES_PER_BANK + page; }
+        inline int romPageIndex(int bank, int page) { return (RAM_BANKS + bank) * PAGES_PER_BANK + page; }
+    private:
+        MachineType m_type;
+        bool m_writeProtectROM;
+        uint8_t m_pagingRegister;
+
+        // RAM banks followed by ROM banks
+        std::shared_ptr<MemoryPage> m_pages[MEMORY_PAGES];
+        uint8_t* m_pageData[MEMORY_PAGES];
+        bool m_pageShared[MEMORY_PAGES];
+        std::vector<uint8_t> m_discard;     // Target of writes to ROM
+
+        // Page table of the CPU address space
+        int m_pageIndex[ADDRESS_SPACE_PAGES];
+        uint8_t* m_readMap[ADDRESS_SPACE_PAGES];
+        uint8_t* m_writeMap[ADDRESS_SPACE_PAGES];
+        uint8_t m_pageFlags[ADDRESS_SPACE_PAGES];
+        uint8_t m_watchFlags[ADDRESS_SPACE_PAGES];
+        MemoryWatcher* m_watcher;
+        ScreenListener* m_screenListener;
+
+#ifdef ZXPP_HEATMAP
+        std::unique_ptr<MemoryHeatmap> m_heatmap;
+#endif
+
+        // Dirty cells of both screen banks (5 and 7) and the map of each
+        // address space page holding screen memory
+        ScreenDirtyMap m_screenDirty[2];
+        ScreenDirtyMap* m_pageDirtyMap[ADDRESS_SPACE_PAGES];
+};
+
+inline MemoryCell::operator uint8_t() const
+{
+    return m_memory->read(m_address);
+}
 
-    uint8_t* begin() { return memory; }
-    uint8_t* end()   { return memory + 0xffff; }
+inline MemoryCell& MemoryCell::operator=(uint8_t value)
+{
+    m_memory->write(m_address, value);
+    return *this;
+}
 
-    uint8_t const* cbegin() const { return memory; }
-    uint8_t const* cend()   const { return memory + 0xffff; }
-    uint8_t const* begin()  const { return cbegin(); }
-    uint8_t const* end()    const { return cend(); }
+// Memory paging of the 128K, port 0x7FFD
+class PagingDevice : public IDevice {
+    public:
+        PagingDevice(SpectrumMemory* memory);
 
+        virtual void receiveData(uint8_t data, uint16_t port, int tState) override;
+        virtual bool sendData(uint8_t& out, uint16_t port, int tState) override;
+    private:
+        SpectrumMemory* m_memory;
 };
 
-#endif
\ No newline at end of file
+#endif
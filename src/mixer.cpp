@@ -0,0 +1,39 @@
+#include "mixer.h"
+
+AudioMixer::AudioMixer()
+    : m_clockRate(3500000.0)
+{}
+
+void AudioMixer::setClockRate(double clockRate)
+{
+    m_clockRate = clockRate;
+    m_buffer.setRates(m_clockRate, m_buffer.getSampleRate());
+}
+
+void AudioMixer::setSampleRate(int sampleRate)
+{
+    m_buffer.setRates(m_clockRate, sampleRate);
+}
+
+int AudioMixer::getSampleRate()
+{
+    return m_buffer.getSampleRate();
+}
+
+int AudioMixer::addSource()
+{
+    m_levels.push_back(0);
+    return (int)m_levels.size() - 1;
+}
+
+void AudioMixer::setLevel(int source, int tState, int amplitude)
+{
+    int delta = amplitude - m_levels[source];
+    m_levels[source] = amplitude;
+    m_buffer.addStep(tState, delta);
+}
+
+void AudioMixer::endFrame(int tStates, std::vector<int16_t>& out)
+{
+    m_buffer.endFrame(tStates, out);
+}
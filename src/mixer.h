@@ -0,0 +1,33 @@
+#pragma once
+
+#include "blep.h"
+
+#include <stdint.h>
+#include <vector>
+
+// Mixes the sound sources of the machine (beeper, AY, tape) into samples
+// at the host rate. Sources report level changes at T-states of the frame,
+// all of them go into one band-limited step buffer, so mixing is free and
+// the resampling is done once per frame for every source together
+class AudioMixer {
+    public:
+        AudioMixer();
+
+        // Input clock (T-states per second) of the machine model
+        void setClockRate(double clockRate);
+        // Output rate, the sound device's
+        void setSampleRate(int sampleRate);
+        int getSampleRate();
+
+        // Register a source, the handle is passed to setLevel
+        int addSource();
+        // Change the output of a source to amplitude at a T-state of the
+        // current frame
+        void setLevel(int source, int tState, int amplitude);
+        // Close a frame tStates long and append the mixed samples to out
+        void endFrame(int tStates, std::vector<int16_t>& out);
+    private:
+        double m_clockRate;
+        std::vector<int> m_levels;      // Current amplitude of each source
+        BlepBuffer m_buffer;
+};
@@ -0,0 +1,97 @@
+#include "pacing.h"
+
+#include <thread>
+#include <algorithm>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <mmsystem.h>
+#endif
+
+FramePacer::FramePacer()
+{
+#ifdef _WIN32
+    // Sleeps are rounded up to the 15.6 ms system tick otherwise
+    timeBeginPeriod(1);
+#endif
+    reset();
+}
+
+FramePacer::~FramePacer()
+{
+#ifdef _WIN32
+    timeEndPeriod(1);
+#endif
+}
+
+void FramePacer::reset()
+{
+    m_deadline = clock::now();
+}
+
+bool FramePacer::wait(double frameTime, bool precise)
+{
+    const clock::duration frame = std::chrono::duration_cast<clock::duration>(
+        std::chrono::duration<double>(frameTime));
+    const clock::duration spin = std::chrono::duration_cast<clock::duration>(
+        std::chrono::duration<double>(PACING_SPIN_TIME));
+
+    m_deadline += frame;
+    clock::time_point now = clock::now();
+    if (now - m_deadline > frame * PACING_MAX_LAG)
+    {
+        m_deadline = now;
+        return false;
+    }
+    if (now >= m_deadline)
+    {
+        return false;
+    }
+
+    if (!precise)
+    {
+        std::this_thread::sleep_until(m_deadline);
+        return true;
+    }
+    if (m_deadline - now > spin)
+    {
+        std::this_thread::sleep_until(m_deadline - spin);
+    }
+    while (clock::now() < m_deadline)
+    {
+        std::this_thread::yield();
+    }
+    return true;
+}
+
+RateControl::RateControl()
+{
+    reset();
+}
+
+void RateControl::reset()
+{
+    m_fill = 0.0;
+    m_measured = false;
+    m_integral = 0.0;
+    m_ratio = 1.0;
+}
+
+double RateControl::adjust(double frameTime, double fill, double target)
+{
+    m_fill = m_measured ? m_fill + (fill - m_fill) * RATE_SMOOTHING : fill;
+    m_measured = true;
+
+    // Proportional-integral, the integral settles at the clock mismatch so
+    // the fill returns to the target instead of staying off by it
+    double error = std::max(-1.0, std::min(1.0, (m_fill - target) / target));
+    m_integral = std::max(-RATE_MAX_SKEW, std::min(RATE_MAX_SKEW, m_integral + error * RATE_INTEGRAL));
+    m_ratio = 1.0 + std::max(-RATE_MAX_SKEW, std::min(RATE_MAX_SKEW, error * RATE_MAX_SKEW + m_integral));
+    return frameTime * m_ratio;
+}
+
+double RateControl::getRatio()
+{
+    return m_ratio;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <chrono>
+
+#define PACING_SPIN_TIME 0.0015         // Seconds before a deadline spent spinning instead of sleeping
+#define PACING_MAX_LAG 5                // Frames the emulation may fall behind before it resyncs
+#define RATE_MAX_SKEW 0.005             // Largest change of the frame period, inaudible and invisible
+#define RATE_SMOOTHING 0.1              // Weight of a new fill measurement, averages out the device's block reads
+#define RATE_INTEGRAL 0.00005           // Integral gain per frame, takes up a constant clock mismatch
+
+// Paces a thread to a fixed frame rate. It sleeps until shortly before each
+// deadline and spins only for the rest, so the thread stays idle for most
+// of the frame but still wakes up on time despite coarse OS timers
+class FramePacer {
+    public:
+        FramePacer();
+        ~FramePacer();
+        FramePacer(const FramePacer&) = delete;
+        FramePacer& operator=(const FramePacer&) = delete;
+
+        // Start counting frames from now
+        void reset();
+        // Wait for the end of a frame frameTime seconds long. Deadlines are
+        // absolute, a late frame is made up for by the next ones. Without
+        // precise only sleeps, for frames where timing doesn't matter.
+        // Returns false if the deadline had already passed
+        bool wait(double frameTime, bool precise = true);
+    private:
+        typedef std::chrono::steady_clock clock;
+        clock::time_point m_deadline;
+};
+
+// Slaves a producer to the consumer of its buffer, e.g. the emulation to
+// the audio device. The frame period is stretched or shortened by at most
+// RATE_MAX_SKEW so that the fill level settles near a target, the producer
+// then runs at the rate the buffer is drained without any drift
+class RateControl {
+    public:
+        RateControl();
+
+        // Forget the measured fill level
+        void reset();
+        // Frame period to wait for, given the nominal one and the fill level
+        // just after the frame was queued
+        double adjust(double frameTime, double fill, double target);
+        // Frame period of the last adjust relative to the nominal one
+        double getRatio();
+    private:
+        double m_fill;
+        bool m_measured;
+        double m_integral;
+        double m_ratio;
+};
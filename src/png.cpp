@@ -0,0 +1,260 @@
+#include "png.h"
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+#define DEFLATE_WINDOW 32768
+#define DEFLATE_MIN_MATCH 3
+#define DEFLATE_MAX_MATCH 258
+#define DEFLATE_HASH_BITS 15
+#define DEFLATE_MAX_CHAIN 32        // Candidates checked for each match
+
+static const uint16_t lengthBase[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t lengthExtra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t distanceBase[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t distanceExtra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+// Deflate streams are packed starting from the least significant bit
+class BitWriter {
+    public:
+        BitWriter(std::vector<uint8_t>& out) : m_out(out), m_bits(0), m_count(0) {}
+
+        void putBits(uint32_t value, int count)
+        {
+            m_bits |= value << m_count;
+            m_count += count;
+            while (m_count >= 8)
+            {
+                m_out.push_back((uint8_t)m_bits);
+                m_bits >>= 8;
+                m_count -= 8;
+            }
+        }
+
+        // Huffman codes are stored starting from the most significant bit
+        void putCode(uint32_t code, int length)
+        {
+            uint32_t reversed = 0;
+            for (int i = 0; i < length; i++)
+            {
+                reversed = (reversed << 1) | ((code >> i) & 1);
+            }
+            putBits(reversed, length);
+        }
+
+        void flush()
+        {
+            if (m_count > 0)
+            {
+                m_out.push_back((uint8_t)m_bits);
+            }
+            m_bits = 0;
+            m_count = 0;
+        }
+    private:
+        std::vector<uint8_t>& m_out;
+        uint32_t m_bits;
+        int m_count;
+};
+
+// Fixed Huffman code of a literal/length symbol (RFC 1951, 3.2.6)
+static void putSymbol(BitWriter& writer, int symbol)
+{
+    if (symbol < 144)       { writer.putCode(0x30 + symbol, 8); }
+    else if (symbol < 256)  { writer.putCode(0x190 + symbol - 144, 9); }
+    else if (symbol < 280)  { writer.putCode(symbol - 256, 7); }
+    else                    { writer.putCode(0xC0 + symbol - 280, 8); }
+}
+
+static void putMatch(BitWriter& writer, int length, int distance)
+{
+    int code = 28;
+    while (lengthBase[code] > length) { code--; }
+    putSymbol(writer, 257 + code);
+    writer.putBits(length - lengthBase[code], lengthExtra[code]);
+
+    code = 29;
+    while (distanceBase[code] > distance) { code--; }
+    writer.putCode(code, 5);
+    writer.putBits(distance - distanceBase[code], distanceExtra[code]);
+}
+
+static inline uint32_t hash3(const uint8_t* p)
+{
+    return ((p[0] << 16 | p[1] << 8 | p[2]) * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+}
+
+static void deflate(const uint8_t* data, size_t size, std::vector<uint8_t>& out)
+{
+    BitWriter writer(out);
+    writer.putBits(1, 1);       // Final block
+    writer.putBits(1, 2);       // Fixed Huffman codes
+
+    // Most recent position of each hash and the previous one with the same hash
+    std::vector<int32_t> head((size_t)1 << DEFLATE_HASH_BITS, -1);
+    std::vector<int32_t> prev(DEFLATE_WINDOW, -1);
+    auto insert = [&](size_t pos) {
+        uint32_t h = hash3(data + pos);
+        prev[pos & (DEFLATE_WINDOW - 1)] = head[h];
+        head[h] = (int32_t)pos;
+    };
+
+    size_t pos = 0;
+    while (pos < size)
+    {
+        int bestLength = 0;
+        int bestDistance = 0;
+        if (pos + DEFLATE_MIN_MATCH <= size)
+        {
+            int maxLength = (int)std::min((size_t)DEFLATE_MAX_MATCH, size - pos);
+            int32_t candidate = head[hash3(data + pos)];
+            for (int chain = 0; chain < DEFLATE_MAX_CHAIN && candidate >= 0; chain++)
+            {
+                if (pos - candidate > DEFLATE_WINDOW - 1) { break; }
+                int length = 0;
+                while (length < maxLength && data[candidate + length] == data[pos + length]) { length++; }
+                if (length > bestLength)
+                {
+                    bestLength = length;
+                    bestDistance = (int)(pos - candidate);
+                    if (length == maxLength) { break; }
+                }
+                candidate = prev[candidate & (DEFLATE_WINDOW - 1)];
+            }
+        }
+
+        if (bestLength >= DEFLATE_MIN_MATCH)
+        {
+            putMatch(writer, bestLength, bestDistance);
+            for (size_t end = pos + bestLength; pos < end; pos++)
+            {
+                if (pos + DEFLATE_MIN_MATCH <= size) { insert(pos); }
+            }
+        }
+        else
+        {
+            putSymbol(writer, data[pos]);
+            if (pos + DEFLATE_MIN_MATCH <= size) { insert(pos); }
+            pos++;
+        }
+    }
+    putSymbol(writer, 256);     // End of block
+    writer.flush();
+}
+
+struct CrcTable {
+    uint32_t values[256];
+
+    CrcTable()
+    {
+        for (uint32_t n = 0; n < 256; n++)
+        {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++)
+            {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            values[n] = c;
+        }
+    }
+};
+
+static uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc = 0)
+{
+    // Initialized once even when encoding on several threads
+    static const CrcTable table;
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+    {
+        crc = table.values[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static uint32_t adler32(const uint8_t* data, size_t size)
+{
+    uint32_t a = 1, b = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        a = (a + data[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    return (b << 16) | a;
+}
+
+static void putUint32(std::vector<uint8_t>& out, uint32_t value)
+{
+    out.push_back((uint8_t)(value >> 24));
+    out.push_back((uint8_t)(value >> 16));
+    out.push_back((uint8_t)(value >> 8));
+    out.push_back((uint8_t)value);
+}
+
+static void putChunk(std::vector<uint8_t>& out, const char* type, const std::vector<uint8_t>& data)
+{
+    putUint32(out, (uint32_t)data.size());
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+    putUint32(out, crc32(&out[start], out.size() - start));
+}
+
+void encodePNG(const uint8_t* rgb, int width, int height, std::vector<uint8_t>& out)
+{
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    out.assign(signature, signature + 8);
+
+    std::vector<uint8_t> header;
+    putUint32(header, width);
+    putUint32(header, height);
+    header.push_back(8);        // Bits per channel
+    header.push_back(2);        // RGB
+    header.push_back(0);        // Deflate
+    header.push_back(0);        // Adaptive filtering
+    header.push_back(0);        // No interlacing
+    putChunk(out, "IHDR", header);
+
+    // Every row starts with its filter type, rows are left unfiltered as
+    // the LZ77 matches already find repeated pixels and lines
+    size_t stride = (size_t)width * 3;
+    std::vector<uint8_t> raw((stride + 1) * height);
+    for (int y = 0; y < height; y++)
+    {
+        raw[y * (stride + 1)] = 0;
+        memcpy(&raw[y * (stride + 1) + 1], rgb + y * stride, stride);
+    }
+
+    std::vector<uint8_t> compressed;
+    compressed.push_back(0x78);     // zlib header, 32 KB window
+    compressed.push_back(0x01);
+    deflate(raw.data(), raw.size(), compressed);
+    putUint32(compressed, adler32(raw.data(), raw.size()));
+    putChunk(out, "IDAT", compressed);
+
+    putChunk(out, "IEND", std::vector<uint8_t>());
+}
+
+bool writePNG(const std::string& filename, const uint8_t* rgb, int width, int height)
+{
+    std::vector<uint8_t> data;
+    encodePNG(rgb, width, height, data);
+
+    FILE* file = fopen(filename.c_str(), "wb");
+    if (file == nullptr) { return false; }
+    bool ok = fwrite(data.data(), 1, data.size(), file) == data.size();
+    return (fclose(file) == 0) && ok;
+}
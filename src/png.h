@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Minimal PNG writer for 24-bit RGB images. Image data is compressed with
+// fixed Huffman deflate and greedy LZ77 matching, which handles the large
+// single color areas of Spectrum frames well without any dependencies
+void encodePNG(const uint8_t* rgb, int width, int height, std::vector<uint8_t>& out);
+
+// Returns false if the file could not be written
+bool writePNG(const std::string& filename, const uint8_t* rgb, int width, int height);
@@ -0,0 +1,326 @@
+#include "recorder.h"
+#include "ula.h"
+
+#include <iostream>
+#include <sstream>
+#include <cstring>
+
+Recorder::Recorder(const RecordSettings& settings)
+    : m_settings(settings),
+      m_videoFile(nullptr),
+      m_audioFile(nullptr),
+      m_audioBytes(0),
+      m_written(0),
+      m_dropped(0),
+      m_queuedFrames(0),
+      m_queuedAudio(0),
+      m_busy(false),
+      m_quit(false)
+{
+    m_videoFile = fopen(m_settings.video.c_str(), "wb");
+    if (m_videoFile == nullptr)
+    {
+        std::cerr << "Failed to open recording output " << m_settings.video << std::endl;
+        return;
+    }
+    if (m_settings.format == RecordFormat::Y4M)
+    {
+        std::stringstream header;
+        header << "YUV4MPEG2 W" << FRAME_WIDTH << " H" << FRAME_HEIGHT
+            << " F" << m_settings.clockRate << ":" << m_settings.tStatesPerFrame << " Ip A1:1 C444\n";
+        fputs(header.str().c_str(), m_videoFile);
+    }
+
+    if (!m_settings.audio.empty())
+    {
+        m_audioFile = fopen(m_settings.audio.c_str(), "wb");
+        if (m_audioFile == nullptr)
+        {
+            std::cerr << "Failed to open recording output " << m_settings.audio << std::endl;
+        }
+        else
+        {
+            // Sizes are filled in when the recording ends
+            writeWavHeader(0);
+        }
+    }
+
+    m_writer = std::thread(&Recorder::run, this);
+}
+
+Recorder::~Recorder()
+{
+    if (m_writer.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_quit = true;
+        }
+        m_wake.notify_one();
+        m_writer.join();
+    }
+
+    if (m_audioFile != nullptr)
+    {
+        fseek(m_audioFile, 0, SEEK_SET);
+        writeWavHeader(m_audioBytes);
+        fclose(m_audioFile);
+    }
+    if (m_videoFile != nullptr)
+    {
+        fclose(m_videoFile);
+    }
+}
+
+bool Recorder::isOpen()
+{
+    return m_videoFile != nullptr;
+}
+
+void Recorder::addFrame(const uint32_t* pixels)
+{
+    if (!isOpen()) { return; }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_queuedFrames >= RECORD_QUEUE_SIZE)
+    {
+        if (m_settings.dropFrames)
+        {
+            // The queue is full of frames, the last one is written again
+            // in place of this one
+            for (auto it = m_chunks.rbegin(); it != m_chunks.rend(); ++it)
+            {
+                if (it->video)
+                {
+                    it->repeats++;
+                    break;
+                }
+            }
+            m_dropped++;
+            return;
+        }
+        m_space.wait(lock, [this] { return m_queuedFrames < RECORD_QUEUE_SIZE; });
+    }
+
+    Chunk chunk;
+    chunk.video = true;
+    chunk.repeats = 0;
+    chunk.silence = 0;
+    if (!m_freeFrames.empty())
+    {
+        chunk.pixels = std::move(m_freeFrames.back());
+        m_freeFrames.pop_back();
+    }
+    chunk.pixels.assign(pixels, pixels + FRAME_WIDTH * FRAME_HEIGHT);
+    m_chunks.push_back(std::move(chunk));
+    m_queuedFrames++;
+    m_wake.notify_one();
+}
+
+void Recorder::addAudio(const int16_t* samples, size_t count)
+{
+    if (m_audioFile == nullptr || count == 0) { return; }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_queuedAudio >= RECORD_QUEUE_SIZE)
+    {
+        if (m_settings.dropFrames)
+        {
+            // Written as silence after the last queued samples, the sound
+            // keeps its length
+            for (auto it = m_chunks.rbegin(); it != m_chunks.rend(); ++it)
+            {
+                if (!it->video)
+                {
+                    it->silence += count;
+                    break;
+                }
+            }
+            return;
+        }
+        m_space.wait(lock, [this] { return m_queuedAudio < RECORD_QUEUE_SIZE; });
+    }
+
+    Chunk chunk;
+    chunk.video = false;
+    chunk.repeats = 0;
+    chunk.silence = 0;
+    chunk.samples.assign(samples, samples + count);
+    m_chunks.push_back(std::move(chunk));
+    m_queuedAudio++;
+    m_wake.notify_one();
+}
+
+void Recorder::flush()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_space.wait(lock, [this] { return m_chunks.empty() && !m_busy; });
+    if (m_videoFile != nullptr) { fflush(m_videoFile); }
+    if (m_audioFile != nullptr) { fflush(m_audioFile); }
+}
+
+int Recorder::getWrittenFrames()
+{
+    return m_written;
+}
+
+int Recorder::getDroppedFrames()
+{
+    return m_dropped;
+}
+
+const RecordSettings& Recorder::getSettings()
+{
+    return m_settings;
+}
+
+void Recorder::run()
+{
+    std::vector<uint8_t> out;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        m_wake.wait(lock, [this] { return m_quit || !m_chunks.empty(); });
+        if (m_chunks.empty()) { return; }
+
+        Chunk chunk = std::move(m_chunks.front());
+        m_chunks.pop_front();
+        m_busy = true;
+        lock.unlock();
+
+        // Drops are added to chunks still in the queue, the counts of this
+        // one don't change any more
+        if (chunk.video)
+        {
+            writeFrame(chunk.pixels, out);
+            for (int i = 0; i < chunk.repeats; i++)
+            {
+                writeVideo(out);
+            }
+        }
+        else
+        {
+            writeAudio(chunk.samples);
+            if (chunk.silence > 0)
+            {
+                writeAudio(std::vector<int16_t>(chunk.silence, 0));
+            }
+        }
+
+        lock.lock();
+        m_busy = false;
+        if (chunk.video)
+        {
+            m_freeFrames.push_back(std::move(chunk.pixels));
+            m_queuedFrames--;
+        }
+        else
+        {
+            m_queuedAudio--;
+        }
+        m_space.notify_all();
+    }
+}
+
+void Recorder::writeFrame(const std::vector<uint32_t>& pixels, std::vector<uint8_t>& out)
+{
+    const size_t count = pixels.size();
+    if (m_settings.format == RecordFormat::Y4M)
+    {
+        // Planar BT.601 studio range. Frames only use the 16 Spectrum
+        // colours, so the last conversion is almost always reused
+        static const char frameHeader[] = "FRAME\n";
+        out.resize(sizeof(frameHeader) - 1 + count * 3);
+        memcpy(out.data(), frameHeader, sizeof(frameHeader) - 1);
+        uint8_t* y = out.data() + sizeof(frameHeader) - 1;
+        uint8_t* u = y + count;
+        uint8_t* v = u + count;
+
+        uint32_t last = ~pixels[0];
+        uint8_t ly = 0, lu = 0, lv = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            uint32_t pixel = pixels[i];
+            if (pixel != last)
+            {
+                int r = (pixel >> 16) & 0xFF;
+                int g = (pixel >> 8) & 0xFF;
+                int b = pixel & 0xFF;
+                ly = (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+                lu = (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+                lv = (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+                last = pixel;
+            }
+            y[i] = ly;
+            u[i] = lu;
+            v[i] = lv;
+        }
+    }
+    else
+    {
+        // Pixels are 0xAARRGGBB
+        out.resize(count * 3);
+        uint8_t* rgb = out.data();
+        for (uint32_t pixel : pixels)
+        {
+            *rgb++ = (uint8_t)(pixel >> 16);
+            *rgb++ = (uint8_t)(pixel >> 8);
+            *rgb++ = (uint8_t)pixel;
+        }
+    }
+
+    writeVideo(out);
+}
+
+void Recorder::writeVideo(const std::vector<uint8_t>& out)
+{
+    if (fwrite(out.data(), 1, out.size(), m_videoFile) == out.size())
+    {
+        m_written++;
+    }
+    else
+    {
+        m_dropped++;
+    }
+}
+
+void Recorder::writeAudio(const std::vector<int16_t>& samples)
+{
+    // WAV samples are little endian
+    std::vector<uint8_t> bytes(samples.size() * 2);
+    for (size_t i = 0; i < samples.size(); i++)
+    {
+        bytes[i * 2] = (uint8_t)samples[i];
+        bytes[i * 2 + 1] = (uint8_t)((uint16_t)samples[i] >> 8);
+    }
+    m_audioBytes += (uint32_t)fwrite(bytes.data(), 1, bytes.size(), m_audioFile);
+}
+
+void Recorder::writeWavHeader(uint32_t dataSize)
+{
+    const uint32_t rate = m_settings.sampleRate;
+    uint8_t header[44];
+    auto put16 = [&header](int offset, uint32_t value) {
+        header[offset] = (uint8_t)value;
+        header[offset + 1] = (uint8_t)(value >> 8);
+    };
+    auto put32 = [&put16](int offset, uint32_t value) {
+        put16(offset, value & 0xFFFF);
+        put16(offset + 2, value >> 16);
+    };
+
+    memcpy(header, "RIFF", 4);
+    put32(4, 36 + dataSize);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    put32(16, 16);              // Format chunk size
+    put16(20, 1);               // PCM
+    put16(22, 1);               // Mono
+    put32(24, rate);
+    put32(28, rate * 2);        // Bytes per second
+    put16(32, 2);               // Bytes per sample
+    put16(34, 16);              // Bits per sample
+    memcpy(header + 36, "data", 4);
+    put32(40, dataSize);
+    fwrite(header, 1, sizeof(header), m_audioFile);
+}
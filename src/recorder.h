@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stdint.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+#define RECORD_QUEUE_SIZE 64            // Video frames, and audio chunks, waiting for the writer, about a second
+
+enum class RecordFormat {
+    Y4M,        // YUV 4:4:4, plays in ffmpeg/mpv and most editors
+    RAW         // RGB24 frames, FRAME_WIDTH x FRAME_HEIGHT
+};
+
+struct RecordSettings {
+    RecordFormat format;
+    std::string video;
+    std::string audio;          // 16-bit mono WAV, empty for no audio
+    int sampleRate;
+    // Frame rate clockRate / tStatesPerFrame, integers so that the rate is
+    // exact and the video keeps in step with the audio
+    uint32_t clockRate;
+    uint32_t tStatesPerFrame;
+    // Drop frames while the writer is behind, otherwise wait for it.
+    // Real time runs drop, batch runs have no deadline and lose nothing.
+    // A dropped frame is written as a copy of the one before and dropped
+    // audio as silence, the video and audio files stay in sync
+    bool dropFrames;
+
+    RecordSettings() : format(RecordFormat::Y4M), video("recording.y4m"), audio(""), sampleRate(44100), clockRate(3500000), tStatesPerFrame(69888), dropFrames(true) {}
+};
+
+// Streams video and audio of a running machine to disk. The emulation
+// thread only copies the data into a queue, a writer thread converts and
+// writes it, so a slow disk never stalls the machine
+class Recorder {
+    public:
+        Recorder(const RecordSettings& settings);
+        // Writes what is queued and finishes the files
+        ~Recorder();
+        Recorder(const Recorder&) = delete;
+        Recorder& operator=(const Recorder&) = delete;
+
+        bool isOpen();
+
+        // Queue FRAME_WIDTH x FRAME_HEIGHT pixels of the ULA frame
+        void addFrame(const uint32_t* pixels);
+        // Queue mono samples produced during the frame
+        void addAudio(const int16_t* samples, size_t count);
+
+        // Block until everything queued is written
+        void flush();
+
+        int getWrittenFrames();
+        int getDroppedFrames();
+        const RecordSettings& getSettings();
+    private:
+        struct Chunk {
+            bool video;
+            std::vector<uint32_t> pixels;
+            std::vector<int16_t> samples;
+            int repeats;                    // Video: frames dropped after this one
+            size_t silence;                 // Audio: samples dropped after these
+        };
+
+        void run();
+        void writeFrame(const std::vector<uint32_t>& pixels, std::vector<uint8_t>& out);
+        void writeVideo(const std::vector<uint8_t>& out);
+        void writeAudio(const std::vector<int16_t>& samples);
+        void writeWavHeader(uint32_t dataSize);
+
+        RecordSettings m_settings;
+        FILE* m_videoFile;
+        FILE* m_audioFile;
+        uint32_t m_audioBytes;
+
+        std::atomic<int> m_written;
+        std::atomic<int> m_dropped;
+
+        std::deque<Chunk> m_chunks;
+        int m_queuedFrames;
+        int m_queuedAudio;
+        bool m_busy;                        // Writer has a chunk out of the queue
+        std::vector<std::vector<uint32_t>> m_freeFrames;    // Reused frame buffers
+        bool m_quit;
+        std::mutex m_mutex;
+        std::condition_variable m_wake;     // New chunk or quit
+        std::condition_variable m_space;    // Chunk written
+        std::thread m_writer;
+};
@@ -0,0 +1,353 @@
+#include "rewind.h"
+
+#include <cstring>
+
+RewindBuffer::RewindBuffer(size_t budget)
+    : m_budget(budget),
+      m_enabled(true),
+      m_used(0),
+      m_position(-1),
+      m_forceKeyframe(true),
+      m_quit(false),
+      m_sinceKeyframe(0)
+{
+    m_worker = std::thread(&RewindBuffer::run, this);
+}
+
+RewindBuffer::~RewindBuffer()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_wake.notify_one();
+    m_worker.join();
+}
+
+void RewindBuffer::push(MachineSnapshot&& snapshot)
+{
+    if (!m_enabled) { return; }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_position >= 0)
+    {
+        // Resuming after a rewind, restore() already waited for the worker
+        while ((int)m_frames.size() > m_position + 1)
+        {
+            m_used -= m_frames.back().data.size();
+            m_frames.pop_back();
+        }
+        m_position = -1;
+        m_forceKeyframe = true;
+    }
+    m_pending.push_back(std::move(snapshot));
+    m_wake.notify_one();
+}
+
+bool RewindBuffer::restore(int frame, MachineSnapshot& snapshot)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_idle.wait(lock, [this] { return m_pending.empty(); });
+    if (frame < 0 || frame >= (int)m_frames.size()) { return false; }
+
+    // The oldest frame is always a keyframe
+    int key = frame;
+    while (!m_frames[key].keyframe) { key--; }
+
+    std::vector<uint8_t> raw;
+    decode(m_frames[key], raw);
+    if (key != frame)
+    {
+        rleDecode(m_frames[frame].data, raw.data(), true);
+    }
+    unflatten(raw, snapshot);
+
+    m_position = frame;
+    return true;
+}
+
+void RewindBuffer::clear()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_idle.wait(lock, [this] { return m_pending.empty(); });
+    m_frames.clear();
+    m_used = 0;
+    m_position = -1;
+    m_forceKeyframe = true;
+}
+
+int RewindBuffer::getFrameCount()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return (int)(m_frames.size() + m_pending.size());
+}
+
+int RewindBuffer::getPosition()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_position >= 0) { return m_position; }
+    return (int)(m_frames.size() + m_pending.size()) - 1;
+}
+
+size_t RewindBuffer::getUsedMemory()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_used;
+}
+
+size_t RewindBuffer::getBudget()
+{
+    return m_budget;
+}
+
+void RewindBuffer::setEnabled(bool enabled)
+{
+    m_enabled = enabled;
+    if (!enabled)
+    {
+        clear();
+    }
+}
+
+bool RewindBuffer::isEnabled()
+{
+    return m_enabled;
+}
+
+void RewindBuffer::run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        m_wake.wait(lock, [this] { return m_quit || !m_pending.empty(); });
+        if (m_quit) { return; }
+
+        // The snapshot stays in the queue until it is encoded, so that
+        // restore() can wait for it
+        MachineSnapshot snapshot = std::move(m_pending.front());
+        bool keyframe = m_forceKeyframe || m_sinceKeyframe >= REWIND_KEYFRAME_INTERVAL - 1;
+        m_forceKeyframe = false;
+        lock.unlock();
+
+        Frame frame;
+        encode(snapshot, keyframe, frame);
+
+        lock.lock();
+        m_pending.pop_front();
+        m_used += frame.data.size();
+        m_frames.push_back(std::move(frame));
+        while (m_used > m_budget && !m_frames.empty())
+        {
+            dropOldest();
+        }
+        if (m_frames.empty())
+        {
+            m_forceKeyframe = true;
+        }
+        if (m_pending.empty())
+        {
+            m_idle.notify_all();
+        }
+    }
+}
+
+void RewindBuffer::encode(const MachineSnapshot& snapshot, bool keyframe, Frame& frame)
+{
+    flatten(snapshot, m_scratch);
+
+    // Device state may change size, deltas need the same layout as the keyframe
+    if (m_scratch.size() != m_keyframeRaw.size())
+    {
+        keyframe = true;
+    }
+    frame.keyframe = keyframe;
+    frame.size = m_scratch.size();
+
+    if (keyframe)
+    {
+        rleEncode(m_scratch.data(), m_scratch.size(), frame.data);
+        m_keyframe = snapshot;
+        m_keyframeRaw.swap(m_scratch);
+        m_sinceKeyframe = 0;
+        return;
+    }
+
+    size_t pagesOffset = frame.size - MEMORY_PAGES * MEMORY_PAGE_SIZE;
+    for (size_t i = 0; i < pagesOffset; i++)
+    {
+        m_scratch[i] ^= m_keyframeRaw[i];
+    }
+    for (int page = 0; page < MEMORY_PAGES; page++)
+    {
+        size_t offset = pagesOffset + page * MEMORY_PAGE_SIZE;
+        uint8_t* delta = &m_scratch[offset];
+
+        // Pages not written since the keyframe are still shared with it
+        if (snapshot.memory.pages[page] == m_keyframe.memory.pages[page])
+        {
+            memset(delta, 0, MEMORY_PAGE_SIZE);
+            continue;
+        }
+        const uint8_t* key = &m_keyframeRaw[offset];
+        for (int i = 0; i < MEMORY_PAGE_SIZE; i++)
+        {
+            delta[i] ^= key[i];
+        }
+    }
+    rleEncode(m_scratch.data(), m_scratch.size(), frame.data);
+    m_sinceKeyframe++;
+}
+
+void RewindBuffer::decode(const Frame& frame, std::vector<uint8_t>& raw)
+{
+    raw.resize(frame.size);
+    rleDecode(frame.data, raw.data(), false);
+}
+
+void RewindBuffer::dropOldest()
+{
+    // Deltas are useless without their keyframe, drop the whole group
+    do
+    {
+        m_used -= m_frames.front().data.size();
+        m_frames.pop_front();
+        if (m_position >= 0) { m_position--; }
+    } while (!m_frames.empty() && !m_frames.front().keyframe);
+}
+
+void RewindBuffer::flatten(const MachineSnapshot& snapshot, std::vector<uint8_t>& out)
+{
+    out.resize(sizeof(Z80State) + 2 + snapshot.devices.size() + MEMORY_PAGES * MEMORY_PAGE_SIZE);
+    uint8_t* p = out.data();
+
+    memcpy(p, &snapshot.cpu, sizeof(Z80State));
+    p += sizeof(Z80State);
+    *p++ = (uint8_t)snapshot.memory.type;
+    *p++ = snapshot.memory.pagingRegister;
+    if (!snapshot.devices.empty())
+    {
+        memcpy(p, snapshot.devices.data(), snapshot.devices.size());
+        p += snapshot.devices.size();
+    }
+    for (int page = 0; page < MEMORY_PAGES; page++)
+    {
+        memcpy(p, snapshot.memory.pages[page]->data, MEMORY_PAGE_SIZE);
+        p += MEMORY_PAGE_SIZE;
+    }
+}
+
+void RewindBuffer::unflatten(const std::vector<uint8_t>& in, MachineSnapshot& snapshot)
+{
+    const uint8_t* p = in.data();
+
+    memcpy(&snapshot.cpu, p, sizeof(Z80State));
+    p += sizeof(Z80State);
+    snapshot.memory.type = (MachineType)*p++;
+    snapshot.memory.pagingRegister = *p++;
+    size_t devicesSize = in.size() - (p - in.data()) - MEMORY_PAGES * MEMORY_PAGE_SIZE;
+    snapshot.devices.assign(p, p + devicesSize);
+    p += devicesSize;
+    for (int page = 0; page < MEMORY_PAGES; page++)
+    {
+        std::shared_ptr<MemoryPage> data = std::make_shared<MemoryPage>();
+        memcpy(data->data, p, MEMORY_PAGE_SIZE);
+        snapshot.memory.pages[page] = data;
+        p += MEMORY_PAGE_SIZE;
+    }
+}
+
+// Stream of tokens, a token is a variable length number (7 bits per byte,
+// least significant first) holding the length and a run flag in bit 0,
+// followed by the repeated byte of a run or the literal bytes
+static void putToken(std::vector<uint8_t>& out, size_t length, bool run)
+{
+    size_t value = (length << 1) | (run ? 1 : 0);
+    while (value >= 0x80)
+    {
+        out.push_back((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((uint8_t)value);
+}
+
+static size_t getToken(const uint8_t*& in)
+{
+    size_t value = 0;
+    int shift = 0;
+    uint8_t byte;
+    do
+    {
+        byte = *in++;
+        value |= (size_t)(byte & 0x7F) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return value;
+}
+
+void RewindBuffer::rleEncode(const uint8_t* in, size_t size, std::vector<uint8_t>& out)
+{
+    out.clear();
+    size_t literals = 0;        // Start of the literals not yet written
+    size_t i = 0;
+    while (i < size)
+    {
+        size_t run = 1;
+        while (i + run < size && in[i + run] == in[i]) { run++; }
+        if (run < REWIND_MIN_RUN)
+        {
+            i += run;
+            continue;
+        }
+        if (literals < i)
+        {
+            putToken(out, i - literals, false);
+            out.insert(out.end(), in + literals, in + i);
+        }
+        putToken(out, run, true);
+        out.push_back(in[i]);
+        i += run;
+        literals = i;
+    }
+    if (literals < size)
+    {
+        putToken(out, size - literals, false);
+        out.insert(out.end(), in + literals, in + size);
+    }
+    out.shrink_to_fit();
+}
+
+void RewindBuffer::rleDecode(const std::vector<uint8_t>& in, uint8_t* out, bool xorInto)
+{
+    const uint8_t* p = in.data();
+    const uint8_t* end = p + in.size();
+    while (p < end)
+    {
+        size_t token = getToken(p);
+        size_t length = token >> 1;
+        if (token & 1)
+        {
+            uint8_t value = *p++;
+            if (!xorInto)
+            {
+                memset(out, value, length);
+            }
+            else if (value != 0)
+            {
+                for (size_t i = 0; i < length; i++) { out[i] ^= value; }
+            }
+        }
+        else
+        {
+            if (!xorInto)
+            {
+                memcpy(out, p, length);
+            }
+            else
+            {
+                for (size_t i = 0; i < length; i++) { out[i] ^= p[i]; }
+            }
+            p += length;
+        }
+        out += length;
+    }
+}
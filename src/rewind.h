@@ -0,0 +1,86 @@
+#pragma once
+
+#include "snapshot.h"
+
+#include <stdint.h>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#define REWIND_BUFFER_SIZE (64 * 1024 * 1024)   // Memory budget of the recorded frames
+#define REWIND_KEYFRAME_INTERVAL 100            // Frames between two full states
+#define REWIND_MIN_RUN 4                        // Shortest run worth encoding as a run
+
+// Records the machine state of every frame. Each frame is stored as an XOR
+// delta against the last keyframe and run-length encoded, so any frame is
+// restored by decoding at most two of them. Encoding runs on a worker thread,
+// the emulation only takes a copy-on-write snapshot
+class RewindBuffer {
+    public:
+        RewindBuffer(size_t budget = REWIND_BUFFER_SIZE);
+        ~RewindBuffer();
+        RewindBuffer(const RewindBuffer&) = delete;
+        RewindBuffer& operator=(const RewindBuffer&) = delete;
+
+        // Record the state at the end of a frame. If the machine was rewound,
+        // the frames after the restored one are dropped first
+        void push(MachineSnapshot&& snapshot);
+
+        // Decode frame (0 is the oldest one), returns false if there is no such frame
+        bool restore(int frame, MachineSnapshot& snapshot);
+
+        void clear();
+
+        // Number of recorded frames, including the ones still being encoded
+        int getFrameCount();
+        // Frame the machine was last restored to, or the newest one
+        int getPosition();
+        size_t getUsedMemory();
+        size_t getBudget();
+
+        void setEnabled(bool enabled);
+        bool isEnabled();
+    private:
+        struct Frame {
+            bool keyframe;
+            size_t size;                // Size of the decoded state
+            std::vector<uint8_t> data;
+        };
+
+        void run();
+        void encode(const MachineSnapshot& snapshot, bool keyframe, Frame& frame);
+        void decode(const Frame& frame, std::vector<uint8_t>& raw);
+        void dropOldest();
+
+        // Layout of a decoded frame: Z80State, machine type, paging register,
+        // device state with the scheduled events and the memory pages
+        static void flatten(const MachineSnapshot& snapshot, std::vector<uint8_t>& out);
+        static void unflatten(const std::vector<uint8_t>& in, MachineSnapshot& snapshot);
+
+        static void rleEncode(const uint8_t* in, size_t size, std::vector<uint8_t>& out);
+        static void rleDecode(const std::vector<uint8_t>& in, uint8_t* out, bool xorInto);
+
+        size_t m_budget;
+        bool m_enabled;
+
+        // Shared with the worker thread, guarded by m_mutex
+        std::deque<Frame> m_frames;
+        std::deque<MachineSnapshot> m_pending;
+        size_t m_used;
+        int m_position;
+        bool m_forceKeyframe;
+        bool m_quit;
+        std::mutex m_mutex;
+        std::condition_variable m_wake;     // New snapshot or quit
+        std::condition_variable m_idle;     // All pending snapshots encoded
+
+        // Used by the worker thread only
+        MachineSnapshot m_keyframe;
+        std::vector<uint8_t> m_keyframeRaw;
+        std::vector<uint8_t> m_scratch;
+        int m_sinceKeyframe;
+
+        std::thread m_worker;
+};
@@ -0,0 +1,89 @@
+#include "scheduler.h"
+
+#include <algorithm>
+#include <cstring>
+
+// Heap order, std::push_heap keeps the largest element in front so the
+// comparison is reversed
+static bool later(const ScheduledEvent& a, const ScheduledEvent& b)
+{
+    if (a.tState != b.tState) { return a.tState > b.tState; }
+    if (a.listener != b.listener) { return a.listener > b.listener; }
+    return a.id > b.id;
+}
+
+Scheduler::Scheduler()
+{
+    m_events.reserve(64);
+}
+
+int Scheduler::addListener(IEventListener* listener)
+{
+    m_listeners.push_back(listener);
+    return (int)m_listeners.size() - 1;
+}
+
+void Scheduler::schedule(int64_t tState, int listener, int id)
+{
+    m_events.push_back({ tState, listener, id });
+    std::push_heap(m_events.begin(), m_events.end(), later);
+}
+
+void Scheduler::cancel(int listener, int id)
+{
+    auto removed = std::remove_if(m_events.begin(), m_events.end(),
+        [listener, id](const ScheduledEvent& e) { return e.listener == listener && e.id == id; });
+    if (removed == m_events.end()) { return; }
+    m_events.erase(removed, m_events.end());
+    std::make_heap(m_events.begin(), m_events.end(), later);
+}
+
+bool Scheduler::isScheduled(int listener, int id)
+{
+    for (const ScheduledEvent& e : m_events)
+    {
+        if (e.listener == listener && e.id == id) { return true; }
+    }
+    return false;
+}
+
+void Scheduler::clear()
+{
+    m_events.clear();
+}
+
+void Scheduler::runDue(int64_t tState)
+{
+    while (!m_events.empty() && m_events.front().tState <= tState)
+    {
+        std::pop_heap(m_events.begin(), m_events.end(), later);
+        ScheduledEvent event = m_events.back();
+        m_events.pop_back();
+        m_listeners[event.listener]->onEvent(event.id, event.tState);
+    }
+}
+
+void Scheduler::saveState(std::vector<uint8_t>& out)
+{
+    uint32_t count = (uint32_t)m_events.size();
+    size_t start = out.size();
+    out.resize(start + sizeof(count) + count * sizeof(ScheduledEvent));
+    memcpy(&out[start], &count, sizeof(count));
+    if (count > 0)
+    {
+        memcpy(&out[start + sizeof(count)], m_events.data(), count * sizeof(ScheduledEvent));
+    }
+}
+
+void Scheduler::loadState(const uint8_t*& in)
+{
+    uint32_t count;
+    memcpy(&count, in, sizeof(count));
+    in += sizeof(count);
+    m_events.resize(count);
+    if (count > 0)
+    {
+        memcpy(m_events.data(), in, count * sizeof(ScheduledEvent));
+    }
+    in += count * sizeof(ScheduledEvent);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#define SCHEDULER_NEVER INT64_MAX
+
+// Implemented by whatever schedules events, gets them back when they are due
+class IEventListener {
+    public:
+    virtual void onEvent(int id, int64_t tState) = 0;
+};
+
+struct ScheduledEvent {
+    int64_t tState;
+    int32_t listener;           // Index of the registered listener
+    int32_t id;
+};
+
+// Events of the machine on the absolute T-state clock (counted from power
+// on) in a min-heap. The CPU only compares its clock against the time of
+// the earliest event, so the cost per instruction doesn't grow with the
+// number of devices that need to be woken up at some T-state
+class Scheduler {
+    public:
+        Scheduler();
+
+        // Listeners are registered once, events refer to them by index so
+        // that snapshots of the queue stay valid
+        int addListener(IEventListener* listener);
+
+        // Call onEvent of a listener at tState, in order of time. Events at
+        // the same T-state run in the order of listener and id
+        void schedule(int64_t tState, int listener, int id);
+        // Remove the pending events of a listener with this id
+        void cancel(int listener, int id);
+        bool isScheduled(int listener, int id);
+        // Remove all events
+        void clear();
+
+        // T-state of the earliest event, SCHEDULER_NEVER if there is none
+        inline int64_t getNextTime()
+        {
+            return m_events.empty() ? SCHEDULER_NEVER : m_events.front().tState;
+        }
+        // Dispatch all events due at tState or earlier, the listeners may
+        // schedule new ones
+        void runDue(int64_t tState);
+
+        // The pending events, for machine snapshots
+        void saveState(std::vector<uint8_t>& out);
+        void loadState(const uint8_t*& in);
+    private:
+        std::vector<IEventListener*> m_listeners;
+        std::vector<ScheduledEvent> m_events;       // Heap, earliest first
+};
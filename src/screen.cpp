@@ -0,0 +1,78 @@
+#include "screen.h"
+
+ScreenConverter::ScreenConverter()
+{
+    // http://www.animatez.co.uk/computers/zx-spectrum/screen-memory-layout/
+    for (int y = 0; y < SCREEN_HEIGHT; y++)
+    {
+        m_lineOffsets[y] = (uint16_t)(((y >> 6) << 11) | ((y & 0x7) << 8) | (((y >> 3) & 0x7) << 5));
+    }
+
+    for (int byte = 0; byte < 256; byte++)
+    {
+        for (int bit = 0; bit < 8; bit++)
+        {
+            m_masks[byte][bit] = (byte & (0x80 >> bit)) ? 0xFFFFFFFF : 0;
+        }
+    }
+
+    // Colors are stored as 1 bit per channel in GRB format
+    for (int color = 0; color < 16; color++)
+    {
+        uint32_t level = (color & 0x08) ? 255 : 128;
+        uint32_t r = (color & 0x2) ? level : 0;
+        uint32_t g = (color & 0x4) ? level : 0;
+        uint32_t b = (color & 0x1) ? level : 0;
+        m_palette[color] = 0xFF000000 | (r << 16) | (g << 8) | b;
+    }
+
+    for (int attributes = 0; attributes < 256; attributes++)
+    {
+        int bright = (attributes & 0x40) ? 0x08 : 0;
+        uint32_t ink = m_palette[(attributes & 0x07) | bright];
+        uint32_t paper = m_palette[((attributes >> 3) & 0x07) | bright];
+        m_ink[0][attributes] = ink;
+        m_paper[0][attributes] = paper;
+
+        // FLASH swaps ink and paper in the inverted phase
+        bool flash = (attributes & 0x80) != 0;
+        m_ink[1][attributes] = flash ? paper : ink;
+        m_paper[1][attributes] = flash ? ink : paper;
+    }
+}
+
+void ScreenConverter::convertCell(uint8_t* const* screen, int cell, bool flashInverted,
+    uint32_t* pixels, int pitch) const
+{
+    uint16_t memCol = SCREEN_BITMAP_SIZE + cell;
+    uint8_t attributes = screen[memCol >> MEMORY_PAGE_SHIFT][memCol & MEMORY_PAGE_MASK];
+
+    int x = cell % (SCREEN_WIDTH / 8);
+    int y = (cell / (SCREEN_WIDTH / 8)) * 8;
+    uint32_t* out = pixels + y * pitch + x * 8;
+    for (int line = 0; line < 8; line++, out += pitch)
+    {
+        uint16_t memPos = m_lineOffsets[y + line] | x;
+        expandByte(screen[memPos >> MEMORY_PAGE_SHIFT][memPos & MEMORY_PAGE_MASK],
+            attributes, flashInverted, out);
+    }
+}
+
+void ScreenConverter::convertScreen(uint8_t* const* screen, bool flashInverted,
+    uint32_t* pixels, int pitch) const
+{
+    for (int y = 0; y < SCREEN_HEIGHT; y++)
+    {
+        // A line of the bitmap or attributes never crosses a memory page
+        uint16_t memPos = m_lineOffsets[y];
+        const uint8_t* bitmap = &screen[memPos >> MEMORY_PAGE_SHIFT][memPos & MEMORY_PAGE_MASK];
+        uint16_t memCol = SCREEN_BITMAP_SIZE + (y >> 3) * (SCREEN_WIDTH / 8);
+        const uint8_t* attributes = &screen[memCol >> MEMORY_PAGE_SHIFT][memCol & MEMORY_PAGE_MASK];
+
+        uint32_t* out = pixels + y * pitch;
+        for (int x = 0; x < SCREEN_WIDTH / 8; x++, out += 8)
+        {
+            expandByte(bitmap[x], attributes[x], flashInverted, out);
+        }
+    }
+}
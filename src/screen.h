@@ -0,0 +1,63 @@
+#pragma once
+
+#include "memory.h"
+
+#include <stdint.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define ZXPP_SSE2
+    #include <emmintrin.h>
+#endif
+
+#define SCREEN_WIDTH 256
+#define SCREEN_HEIGHT 192
+
+// Converts the screen memory to 32-bit pixels 0xAARRGGBB (B, G, R, A in memory).
+// Every bitmap byte is expanded through a table of pixel masks, ink and paper
+// colors of each attribute are precomputed for both FLASH phases
+class ScreenConverter {
+    public:
+        ScreenConverter();
+
+        // Offset of pixel line y from the start of the screen bank
+        inline uint16_t getLineOffset(int y) const { return m_lineOffsets[y]; }
+
+        // Color 0-7, bit 3 selects the bright version
+        inline uint32_t getColor(int color) const { return m_palette[color & 0x0F]; }
+
+        // Write the 8 pixels of a bitmap byte
+        inline void expandByte(uint8_t byte, uint8_t attributes, bool flashInverted, uint32_t* out) const
+        {
+            uint32_t ink = m_ink[flashInverted][attributes];
+            uint32_t paper = m_paper[flashInverted][attributes];
+#ifdef ZXPP_SSE2
+            __m128i inkx4 = _mm_set1_epi32((int)ink);
+            __m128i paperx4 = _mm_set1_epi32((int)paper);
+            __m128i mask0 = _mm_load_si128((const __m128i*)&m_masks[byte][0]);
+            __m128i mask1 = _mm_load_si128((const __m128i*)&m_masks[byte][4]);
+            _mm_storeu_si128((__m128i*)out,
+                _mm_or_si128(_mm_and_si128(mask0, inkx4), _mm_andnot_si128(mask0, paperx4)));
+            _mm_storeu_si128((__m128i*)(out + 4),
+                _mm_or_si128(_mm_and_si128(mask1, inkx4), _mm_andnot_si128(mask1, paperx4)));
+#else
+            for (int i = 0; i < 8; i++)
+            {
+                out[i] = (m_masks[byte][i] & ink) | (~m_masks[byte][i] & paper);
+            }
+#endif
+        }
+
+        // Convert one 8x8 character cell, pitch is the length of an output line in pixels
+        void convertCell(uint8_t* const* screen, int cell, bool flashInverted,
+            uint32_t* pixels, int pitch) const;
+
+        // Convert the whole 256x192 screen
+        void convertScreen(uint8_t* const* screen, bool flashInverted,
+            uint32_t* pixels, int pitch) const;
+    private:
+        alignas(16) uint32_t m_masks[256][8];
+        uint32_t m_ink[2][256];
+        uint32_t m_paper[2][256];
+        uint32_t m_palette[16];
+        uint16_t m_lineOffsets[SCREEN_HEIGHT];
+};
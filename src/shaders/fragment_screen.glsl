@@ -0,0 +1,41 @@
+#version 330 core
+
+// Decodes the raw screen memory, the texture is 32 bytes wide and holds
+// 192 rows of bitmap followed by 24 rows of attributes
+in vec2 UV;
+out vec4 color;
+uniform usampler2D inScreen;
+uniform int border;
+uniform bool flashInverted;
+
+// FRAME_WIDTH x FRAME_HEIGHT and the paper position, see ula.h
+const ivec2 FRAME_SIZE = ivec2(352, 296);
+const ivec2 PAPER_ORIGIN = ivec2(48, 52);
+const ivec2 PAPER_SIZE = ivec2(256, 192);
+
+// Colors are stored as 1 bit per channel in GRB format, bit 3 is BRIGHT
+vec4 palette(uint c) {
+    float level = (c & 8u) != 0u ? 1.0 : 128.0 / 255.0;
+    return vec4(vec3((c >> 1) & 1u, (c >> 2) & 1u, c & 1u) * level, 1.0);
+}
+
+void main() {
+    ivec2 p = ivec2(UV * vec2(FRAME_SIZE)) - PAPER_ORIGIN;
+    if (any(lessThan(p, ivec2(0))) || any(greaterThanEqual(p, PAPER_SIZE))) {
+        color = palette(uint(border));
+        return;
+    }
+
+    // Third of the screen is bits 11-12, pixel line 8-10 and character row 5-7
+    int column = p.x >> 3;
+    int offset = ((p.y >> 6) << 11) | ((p.y & 7) << 8) | (((p.y >> 3) & 7) << 5) | column;
+    uint bitmap = texelFetch(inScreen, ivec2(offset & 31, offset >> 5), 0).r;
+    uint attributes = texelFetch(inScreen, ivec2(column, PAPER_SIZE.y + (p.y >> 3)), 0).r;
+
+    bool ink = ((bitmap >> uint(7 - (p.x & 7))) & 1u) != 0u;
+    if (flashInverted && (attributes & 0x80u) != 0u) {
+        ink = !ink;
+    }
+    uint bright = (attributes & 0x40u) >> 3;
+    color = palette(((ink ? attributes : attributes >> 3) & 7u) | bright);
+}
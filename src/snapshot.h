@@ -0,0 +1,14 @@
+#pragma once
+
+#include "z80.h"
+#include "memory.h"
+
+#include <vector>
+
+// State of the whole machine, memory pages are shared with the running
+// machine until either side writes to them (see SpectrumMemory::saveSnapshot)
+struct MachineSnapshot {
+    Z80State cpu;
+    MemorySnapshot memory;
+    std::vector<uint8_t> devices;       // Device state followed by the scheduled events
+};
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+
+// Bounded queue for exactly one producer and one consumer thread, without
+// locking. Size has to be a power of two, one slot is always kept free
+template<typename T, size_t Size>
+class SPSCQueue {
+    static_assert((Size & (Size - 1)) == 0, "SPSCQueue size has to be a power of two");
+    public:
+        SPSCQueue()
+            : m_head(0),
+              m_tail(0)
+        {}
+        SPSCQueue(const SPSCQueue&) = delete;
+        SPSCQueue& operator=(const SPSCQueue&) = delete;
+
+        // Producer side, returns false if the queue is full
+        bool push(const T& value)
+        {
+            size_t tail = m_tail.load(std::memory_order_relaxed);
+            size_t next = (tail + 1) & (Size - 1);
+            if (next == m_head.load(std::memory_order_acquire)) { return false; }
+            m_items[tail] = value;
+            m_tail.store(next, std::memory_order_release);
+            return true;
+        }
+
+        // Consumer side, returns false if the queue is empty
+        bool pop(T& value)
+        {
+            size_t head = m_head.load(std::memory_order_relaxed);
+            if (head == m_tail.load(std::memory_order_acquire)) { return false; }
+            value = m_items[head];
+            m_head.store((head + 1) & (Size - 1), std::memory_order_release);
+            return true;
+        }
+
+        // Bulk versions, return the number of values actually moved
+        size_t push(const T* values, size_t count)
+        {
+            size_t tail = m_tail.load(std::memory_order_relaxed);
+            size_t free = (m_head.load(std::memory_order_acquire) - tail - 1) & (Size - 1);
+            count = (count < free) ? count : free;
+            for (size_t i = 0; i < count; i++)
+            {
+                m_items[(tail + i) & (Size - 1)] = values[i];
+            }
+            m_tail.store((tail + count) & (Size - 1), std::memory_order_release);
+            return count;
+        }
+        size_t pop(T* values, size_t count)
+        {
+            size_t head = m_head.load(std::memory_order_relaxed);
+            size_t used = (m_tail.load(std::memory_order_acquire) - head) & (Size - 1);
+            count = (count < used) ? count : used;
+            for (size_t i = 0; i < count; i++)
+            {
+                values[i] = m_items[(head + i) & (Size - 1)];
+            }
+            m_head.store((head + count) & (Size - 1), std::memory_order_release);
+            return count;
+        }
+
+        // Number of queued values, only a snapshot when called while the
+        // other side is running
+        size_t size() const
+        {
+            return (m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire)) & (Size - 1);
+        }
+    private:
+        T m_items[Size];
+
+        // Written by the consumer and the producer respectively
+        std::atomic<size_t> m_head;
+        std::atomic<size_t> m_tail;
+};
@@ -0,0 +1,263 @@
+#include "tape.h"
+
+#include <iostream>
+#include <cstring>
+
+// Saved with the machine, the position in the tape follows
+struct TapeState {
+    int64_t pulseEnd;
+    int64_t pulseRemainder;
+    uint32_t insertions;
+    int32_t playing;
+    int32_t level;
+};
+
+Tape::Tape()
+    : m_cpu(nullptr),
+      m_memory(nullptr),
+      m_mixer(nullptr),
+      m_source(0),
+      m_insertions(0),
+      m_playing(false),
+      m_level(0),
+      m_pulseEnd(0),
+      m_pulseRemainder(0)
+{
+    m_edges.reserve(1024);
+}
+
+void Tape::attach(Z80* cpu, SpectrumMemory* memory, AudioMixer* mixer)
+{
+    m_cpu = cpu;
+    m_memory = memory;
+    m_mixer = mixer;
+    m_source = mixer->addSource();
+}
+
+bool Tape::insert(std::string filename)
+{
+    eject();
+    if (!m_stream.open(filename))
+    {
+        std::cerr << "Failed to open tape " << filename << std::endl;
+        return false;
+    }
+    m_filename = filename;
+    m_insertions++;
+    return true;
+}
+
+void Tape::eject()
+{
+    stop();
+    m_stream.close();
+    m_filename.clear();
+    m_level = 0;
+}
+
+bool Tape::isInserted()
+{
+    return m_stream.isOpen();
+}
+
+const std::string& Tape::getFilename()
+{
+    return m_filename;
+}
+
+void Tape::play()
+{
+    if (m_playing || !m_stream.isOpen()) { return; }
+    m_playing = true;
+    m_pulseEnd = m_cpu->getTime();
+    m_pulseRemainder = 0;
+}
+
+void Tape::stop()
+{
+    m_playing = false;
+}
+
+bool Tape::isPlaying()
+{
+    return m_playing;
+}
+
+void Tape::rewind()
+{
+    stop();
+    m_stream.rewind();
+}
+
+int Tape::getBlockCount()
+{
+    return m_stream.getBlockCount();
+}
+
+int Tape::getCurrentBlock()
+{
+    return m_stream.getCurrentBlock();
+}
+
+void Tape::advance(int64_t tState)
+{
+    // The 128K runs a little faster than the tape timings
+    int64_t clock = (int64_t)getMachineModel(m_memory->getMachineType()).clockFrequency;
+    TapePulse pulse;
+    while (m_playing && m_pulseEnd <= tState)
+    {
+        if (!m_stream.next(pulse))
+        {
+            m_playing = false;
+            break;
+        }
+        if (pulse.level != m_level)
+        {
+            m_level = pulse.level;
+            m_edges.push_back({ m_pulseEnd, m_level });
+        }
+        int64_t length = (int64_t)pulse.length * clock + m_pulseRemainder;
+        m_pulseEnd += length / TAPE_CLOCK;
+        m_pulseRemainder = length % TAPE_CLOCK;
+    }
+}
+
+bool Tape::onTrap(Z80* cpu)
+{
+    // LD-BYTES is in the 48K BASIC ROM, ROM 1 on the 128K. Custom ROMs
+    // without it run their own loader. While the tape plays the ROM
+    // loads from the signal
+    const MachineModel& model = getMachineModel(m_memory->getMachineType());
+    if (model.hasPaging && (m_memory->getPagingRegister() & 0x10) == 0) { return false; }
+    if (m_memory->peek(TAPE_LD_BYTES) != TAPE_LD_BYTES_OPCODE) { return false; }
+    if (m_playing || !m_stream.isOpen()) { return false; }
+    if (!m_stream.readStandardBlock(m_block))
+    {
+        if (!m_stream.isAtEnd()) { play(); }
+        return false;
+    }
+
+    // A holds the expected flag byte, carry set loads and reset verifies
+    // DE bytes at IX. The byte after the data is the parity
+    Z80Registers* r = cpu->getRegisters();
+    bool load = r->AF.bytes.low.CF;
+    bool ok = !m_block.empty() && m_block[0] == r->AF.bytes.high;
+    uint8_t parity = ok ? m_block[0] : 0;
+    size_t i = 1;
+    for (; ok && r->DE.word != 0 && i < m_block.size(); i++)
+    {
+        uint8_t value = m_block[i];
+        if (load)
+        {
+            m_memory->write(r->IX.word, value);
+        }
+        else if (m_memory->peek(r->IX.word) != value)
+        {
+            ok = false;
+            break;
+        }
+        parity ^= value;
+        r->IX.word++;
+        r->DE.word--;
+    }
+    ok = ok && r->DE.word == 0 && i < m_block.size();
+
+    if (ok)
+    {
+        // LD A,H; CP 1 at the end of LD-BYTES, carry set if the parity is 0
+        parity ^= m_block[i];
+        uint8_t result = parity - 1;
+        r->HL.bytes.high = parity;
+        r->AF.bytes.high = parity;
+        r->AF.bytes.low.byte = 0;
+        r->AF.bytes.low.SF = (result & 0x80) != 0;
+        r->AF.bytes.low.ZF = result == 0;
+        r->AF.bytes.low.HF = (parity & 0x0F) == 0;
+        r->AF.bytes.low.PF = parity == 0x80;
+        r->AF.bytes.low.NF = true;
+        r->AF.bytes.low.CF = parity == 0;
+    }
+    else
+    {
+        r->AF.bytes.low.ZF = false;
+        r->AF.bytes.low.CF = false;
+    }
+
+    // SA/LD-RET: restore the border, enable interrupts and return
+    cpu->getIoPorts()->writeToPort(0x00FE, (m_memory->peek(TAPE_BORDCR) & 0x38) >> 3);
+    cpu->setIFF1(true);
+    cpu->setIFF2(true);
+    r->PC = CREATE_WORD(m_memory->peek(r->SP), m_memory->peek((uint16_t)(r->SP + 1)));
+    r->SP += 2;
+
+    // The block may have been a custom loader, it reads the blocks the
+    // trap can't load from the signal
+    if (!m_stream.hasStandardBlock() && !m_stream.isAtEnd()) { play(); }
+    return true;
+}
+
+void Tape::receiveData(uint8_t data, uint16_t port, int tState)
+{
+}
+
+bool Tape::sendData(uint8_t& out, uint16_t port, int tState)
+{
+    // Port 0xFE, the other bits are driven by the keyboard. Without a
+    // signal EAR reads 0 (issue 3)
+    if ((port & 0x01) != 0) { return false; }
+
+    advance(m_cpu->getFrameStart() + tState);
+    out = m_level ? 0xFF : 0xBF;
+    return true;
+}
+
+void Tape::saveState(std::vector<uint8_t>& out)
+{
+    TapeState state;
+    state.pulseEnd = m_pulseEnd;
+    state.pulseRemainder = m_pulseRemainder;
+    state.insertions = m_insertions;
+    state.playing = m_playing;
+    state.level = m_level;
+    const TapeCursor& cursor = m_stream.getCursor();
+
+    size_t start = out.size();
+    out.resize(start + sizeof(state) + sizeof(cursor));
+    memcpy(&out[start], &state, sizeof(state));
+    memcpy(&out[start + sizeof(state)], &cursor, sizeof(cursor));
+}
+
+void Tape::loadState(const uint8_t*& in)
+{
+    TapeState state;
+    TapeCursor cursor;
+    memcpy(&state, in, sizeof(state));
+    memcpy(&cursor, in + sizeof(state), sizeof(cursor));
+    in += sizeof(state) + sizeof(cursor);
+
+    // A snapshot taken with another tape in the deck leaves this one alone
+    if (state.insertions != m_insertions) { return; }
+    m_stream.setCursor(cursor);
+    m_pulseEnd = state.pulseEnd;
+    m_pulseRemainder = state.pulseRemainder;
+    m_playing = state.playing != 0;
+    m_level = state.level;
+}
+
+void Tape::endFrame()
+{
+    // The CPU is at the start of the next frame already
+    int tStatesPerFrame = getMachineModel(m_memory->getMachineType()).tStatesPerFrame;
+    int64_t frameEnd = m_cpu->getFrameStart();
+    advance(frameEnd - 1);
+    for (const TapeEdge& edge : m_edges)
+    {
+        m_mixer->setLevel(m_source, (int)(edge.tState - (frameEnd - tStatesPerFrame)), edge.level ? TAPE_VOLUME : 0);
+    }
+    m_edges.clear();
+}
+
+void Tape::discardFrame()
+{
+    m_edges.clear();
+}
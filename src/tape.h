@@ -0,0 +1,83 @@
+#pragma once
+
+#include "devices.h"
+#include "z80.h"
+#include "memory.h"
+#include "mixer.h"
+#include "tapestream.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define TAPE_LD_BYTES 0x0556            // LD-BYTES of the 48K BASIC ROM
+#define TAPE_LD_BYTES_OPCODE 0x14       // INC D, the first instruction of LD-BYTES
+#define TAPE_BORDCR 0x5C48              // System variable with the border colour in bits 3-5
+#define TAPE_VOLUME 2048                // The signal is heard quietly through the speaker
+
+struct TapeEdge {
+    int64_t tState;                     // Absolute, see Z80::getTime
+    int level;
+};
+
+// Cassette deck with a TAP, TZX or PZX file. While the tape plays, its
+// signal is read on bit 6 (EAR) of port 0xFE, the pulses are generated from
+// the file up to the T-state of each read. While it is stopped the ROM
+// loader is trapped: when the CPU calls LD-BYTES the next standard speed
+// block is copied straight into memory and the routine returns as if it
+// had loaded it. Blocks the trap can't load (turbo, pulse sequences,
+// direct recordings) start the tape and are loaded from the signal
+class Tape : public IDevice, public ITrapHandler {
+    public:
+        Tape();
+
+        void attach(Z80* cpu, SpectrumMemory* memory, AudioMixer* mixer);
+
+        // Returns false if the file can't be read, the tape is ejected then
+        bool insert(std::string filename);
+        void eject();
+        bool isInserted();
+        const std::string& getFilename();
+
+        // The tape stops by itself at stop blocks and at its end
+        void play();
+        void stop();
+        bool isPlaying();
+
+        void rewind();
+        int getBlockCount();
+        // Blocks started so far
+        int getCurrentBlock();
+
+        virtual bool onTrap(Z80* cpu) override;
+
+        virtual void receiveData(uint8_t data, uint16_t port, int tState) override;
+        virtual bool sendData(uint8_t& out, uint16_t port, int tState) override;
+        virtual void saveState(std::vector<uint8_t>& out) override;
+        virtual void loadState(const uint8_t*& in) override;
+
+        // Play the signal up to the end of the frame that was just
+        // emulated and pass its edges to the mixer
+        void endFrame();
+        // Forget the edges of a frame that is not heard (run-ahead)
+        void discardFrame();
+    private:
+        // Play the pulses that end at tState or earlier, their lengths are
+        // scaled from TAPE_CLOCK to the clock of the machine
+        void advance(int64_t tState);
+
+        TapeStream m_stream;
+        Z80* m_cpu;
+        SpectrumMemory* m_memory;
+        AudioMixer* m_mixer;
+        int m_source;
+        std::string m_filename;
+        uint32_t m_insertions;          // Tells snapshots of other tapes apart
+
+        bool m_playing;
+        int m_level;                    // EAR input
+        int64_t m_pulseEnd;             // Absolute T-state of the next edge
+        int64_t m_pulseRemainder;       // Fraction of a T-state, in 1/TAPE_CLOCK
+        std::vector<TapeEdge> m_edges;
+        std::vector<uint8_t> m_block;   // Block loaded by the trap, reused
+};
@@ -0,0 +1,631 @@
+#include "tapestream.h"
+
+#include <cstring>
+#include <algorithm>
+
+// Results of parsing a block header
+#define TAPE_BLOCK_SIGNAL 0             // Block has pulses or a pause
+#define TAPE_BLOCK_SILENT 1             // Information, groups, loop start
+#define TAPE_BLOCK_STOP 2               // Stop the tape
+#define TAPE_BLOCK_LOOP 3               // End of a loop, back to loopStart
+#define TAPE_BLOCK_END 4                // End of the file
+
+// Timings of the ROM saving routine
+#define TAPE_PILOT_LENGTH 2168
+#define TAPE_PILOT_HEADER 8063          // Pilot pulses before a header (flag < 128)
+#define TAPE_PILOT_DATA 3223
+#define TAPE_SYNC1_LENGTH 667
+#define TAPE_SYNC2_LENGTH 735
+#define TAPE_ZERO_LENGTH 855
+#define TAPE_ONE_LENGTH 1710
+
+static void setupData(TapeCursor& c, int64_t data, uint32_t length, int usedBits, uint32_t zero, uint32_t one)
+{
+    // The last byte may be used only partly, from the top bit
+    if (usedBits < 1 || usedBits > 8) { usedBits = 8; }
+    c.data = data;
+    c.dataBits = (length == 0) ? 0 : (length - 1) * 8 + usedBits;
+    c.bitMask = 0x80;
+    c.bitPulses[0] = 2;
+    c.bitPulses[1] = 2;
+    c.bitLength[0] = zero;
+    c.bitLength[1] = one;
+}
+
+static void setupStandard(TapeCursor& c, int64_t data, uint32_t length, uint8_t flag, uint32_t pause)
+{
+    c.standard = 1;
+    c.toneLength = TAPE_PILOT_LENGTH;
+    c.toneCount = (flag < 128) ? TAPE_PILOT_HEADER : TAPE_PILOT_DATA;
+    c.sync[0] = TAPE_SYNC1_LENGTH;
+    c.sync[1] = TAPE_SYNC2_LENGTH;
+    c.syncCount = 2;
+    setupData(c, data, length, 8, TAPE_ZERO_LENGTH, TAPE_ONE_LENGTH);
+    c.pauseLength = pause * TAPE_MS_TSTATES;
+}
+
+TapeStream::TapeStream()
+    : m_file(nullptr),
+      m_format(TapeFormat::TAP),
+      m_size(0),
+      m_firstBlock(0),
+      m_blockCount(0),
+      m_buffer(TAPE_FILE_BUFFER),
+      m_bufferStart(0),
+      m_bufferSize(0)
+{
+    for (int i = 0; i < 2; i++)
+    {
+        m_sequence[i].reserve(256);
+        m_sequenceOffset[i] = 0;
+    }
+    rewind();
+}
+
+TapeStream::~TapeStream()
+{
+    close();
+}
+
+bool TapeStream::open(std::string filename)
+{
+    close();
+    m_file = fopen(filename.c_str(), "rb");
+    if (m_file == nullptr) { return false; }
+
+    fseek(m_file, 0, SEEK_END);
+    m_size = ftell(m_file);
+
+    char header[8];
+    for (int i = 0; i < 8; i++)
+    {
+        header[i] = (char)readByte(i);
+    }
+    if (memcmp(header, "ZXTape!\x1A", 8) == 0)
+    {
+        // Followed by the version, two bytes
+        m_format = TapeFormat::TZX;
+        m_firstBlock = 10;
+    }
+    else if (memcmp(header, "PZXT", 4) == 0)
+    {
+        // The header is a block of its own
+        m_format = TapeFormat::PZX;
+        m_firstBlock = 0;
+    }
+    else
+    {
+        m_format = TapeFormat::TAP;
+        m_firstBlock = 0;
+    }
+
+    // Loops aren't followed, every header counts once
+    TapeCursor c;
+    memset(&c, 0, sizeof(c));
+    c.block = m_firstBlock;
+    m_blockCount = 0;
+    while (parseBlock(c) != TAPE_BLOCK_END)
+    {
+        m_blockCount++;
+    }
+
+    rewind();
+    return true;
+}
+
+void TapeStream::close()
+{
+    if (m_file != nullptr)
+    {
+        fclose(m_file);
+        m_file = nullptr;
+    }
+    m_size = 0;
+    m_firstBlock = 0;
+    m_blockCount = 0;
+    m_bufferSize = 0;
+    m_sequenceOffset[0] = m_sequenceOffset[1] = 0;
+    rewind();
+}
+
+bool TapeStream::isOpen()
+{
+    return m_file != nullptr;
+}
+
+TapeFormat TapeStream::getFormat()
+{
+    return m_format;
+}
+
+void TapeStream::rewind()
+{
+    memset(&m_cursor, 0, sizeof(m_cursor));
+    m_cursor.block = m_firstBlock;
+    m_cursor.stage = TAPE_STAGE_BLOCK;
+    m_cursor.bitMask = 0x80;
+    m_cursor.pauseLevel = -1;
+}
+
+bool TapeStream::isAtEnd()
+{
+    return m_cursor.stage == TAPE_STAGE_END ||
+           (m_cursor.stage == TAPE_STAGE_BLOCK && m_cursor.block >= m_size);
+}
+
+int TapeStream::getBlockCount()
+{
+    return m_blockCount;
+}
+
+int TapeStream::getCurrentBlock()
+{
+    return m_cursor.index;
+}
+
+const TapeCursor& TapeStream::getCursor()
+{
+    return m_cursor;
+}
+
+void TapeStream::setCursor(const TapeCursor& cursor)
+{
+    m_cursor = cursor;
+}
+
+bool TapeStream::next(TapePulse& pulse)
+{
+    TapeCursor& c = m_cursor;
+    while (true)
+    {
+        switch (c.stage)
+        {
+            case TAPE_STAGE_BLOCK:
+            {
+                int result = parseBlock(c);
+                if (result == TAPE_BLOCK_END) { return false; }
+                if (result == TAPE_BLOCK_STOP) { return false; }
+                if (result == TAPE_BLOCK_LOOP && c.loopCount > 1)
+                {
+                    c.loopCount--;
+                    c.block = c.loopStart;
+                }
+                continue;
+            }
+            case TAPE_STAGE_TONE:
+                if (c.toneCount == 0) { break; }
+                c.toneCount--;
+                c.level ^= 1;
+                pulse.length = c.toneLength;
+                pulse.level = c.level;
+                return true;
+            case TAPE_STAGE_SYNC:
+                if (c.syncCount == 0) { break; }
+                c.level ^= 1;
+                pulse.length = c.sync[2 - c.syncCount--];
+                pulse.level = c.level;
+                return true;
+            case TAPE_STAGE_PULSES:
+                if (c.repeat > 0)
+                {
+                    c.repeat--;
+                    c.level ^= 1;
+                    pulse.length = c.repeatLength;
+                    pulse.level = c.level;
+                    return true;
+                }
+                if (c.pulses >= c.pulsesEnd) { break; }
+                c.repeat = 1;
+                c.repeatLength = readWord(c.pulses);
+                c.pulses += 2;
+                if (m_format == TapeFormat::PZX)
+                {
+                    // Optional repeat count, then 15 or 31 bits of length
+                    if (c.repeatLength > 0x8000)
+                    {
+                        c.repeat = c.repeatLength & 0x7FFF;
+                        c.repeatLength = readWord(c.pulses);
+                        c.pulses += 2;
+                    }
+                    if (c.repeatLength >= 0x8000)
+                    {
+                        c.repeatLength = ((c.repeatLength & 0x7FFF) << 16) | readWord(c.pulses);
+                        c.pulses += 2;
+                    }
+                }
+                continue;
+            case TAPE_STAGE_DATA:
+            {
+                if (c.bitPulse == 0)
+                {
+                    if (c.dataBits == 0) { break; }
+                    c.bit = readBit(c) ? 1 : 0;
+                }
+                uint32_t count = c.bitPulses[c.bit];
+                if (count == 0) { continue; }
+                pulse.length = (c.bitSequence[c.bit] != 0) ? sequenceLength(c, c.bit, c.bitPulse) : c.bitLength[c.bit];
+                if (++c.bitPulse == count) { c.bitPulse = 0; }
+                c.level ^= 1;
+                pulse.level = c.level;
+                return true;
+            }
+            case TAPE_STAGE_DIRECT:
+            {
+                if (c.dataBits == 0) { break; }
+                // A run of equal samples is one pulse
+                int level = readBit(c) ? 1 : 0;
+                pulse.length = c.sampleLength;
+                while (c.dataBits > 0 && ((readByte(c.data) & c.bitMask) != 0) == (level != 0))
+                {
+                    readBit(c);
+                    pulse.length += c.sampleLength;
+                }
+                c.level = level;
+                pulse.level = level;
+                return true;
+            }
+            case TAPE_STAGE_TAIL:
+                if (c.tailLength == 0) { break; }
+                c.level ^= 1;
+                pulse.length = c.tailLength;
+                pulse.level = c.level;
+                c.tailLength = 0;
+                return true;
+            case TAPE_STAGE_PAUSE:
+                if (c.pauseLength == 0) { break; }
+                if (c.pauseLevel < 0)
+                {
+                    // TZX: an edge ends the last pulse, after 1 ms the level is low
+                    pulse.length = std::min(c.pauseLength, (uint32_t)TAPE_MS_TSTATES);
+                    c.pauseLength -= pulse.length;
+                    c.pauseLevel = 0;
+                    c.level ^= 1;
+                }
+                else
+                {
+                    pulse.length = c.pauseLength;
+                    c.pauseLength = 0;
+                    c.level = c.pauseLevel;
+                }
+                pulse.level = c.level;
+                return true;
+            default:
+                return false;
+        }
+        c.stage = (c.stage == TAPE_STAGE_PAUSE) ? TAPE_STAGE_BLOCK : c.stage + 1;
+    }
+}
+
+bool TapeStream::findStandardBlock(TapeCursor& c)
+{
+    // The rest of a block played partly is skipped
+    if (c.stage == TAPE_STAGE_END) { return false; }
+    while (true)
+    {
+        int result = parseBlock(c);
+        if (result == TAPE_BLOCK_END) { return false; }
+        if (result == TAPE_BLOCK_LOOP && c.loopCount > 1)
+        {
+            c.loopCount--;
+            c.block = c.loopStart;
+        }
+        if (result != TAPE_BLOCK_SIGNAL) { continue; }
+        if (c.standard) { return true; }
+
+        // Pauses are passed over, any other signal is for a custom loader
+        bool pulses = c.toneCount > 0 || c.syncCount > 0 || c.pulses < c.pulsesEnd ||
+                      c.dataBits > 0 || c.tailLength > 0;
+        if (pulses) { return false; }
+    }
+}
+
+bool TapeStream::readStandardBlock(std::vector<uint8_t>& data)
+{
+    TapeCursor c = m_cursor;
+    if (!findStandardBlock(c)) { return false; }
+
+    data.resize(c.dataBits / 8);
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        data[i] = readByte(c.data + i);
+    }
+
+    // Continue with the pause after the block
+    c.toneCount = 0;
+    c.syncCount = 0;
+    c.dataBits = 0;
+    c.stage = TAPE_STAGE_PAUSE;
+    m_cursor = c;
+    return true;
+}
+
+bool TapeStream::hasStandardBlock()
+{
+    TapeCursor c = m_cursor;
+    return findStandardBlock(c);
+}
+
+int TapeStream::parseBlock(TapeCursor& c)
+{
+    // Clear what the previous block left to play
+    c.stage = TAPE_STAGE_TONE;
+    c.standard = 0;
+    c.toneCount = 0;
+    c.syncCount = 0;
+    c.pulses = c.pulsesEnd = 0;
+    c.repeat = 0;
+    c.dataBits = 0;
+    c.bitPulse = 0;
+    c.bitSequence[0] = c.bitSequence[1] = 0;
+    c.tailLength = 0;
+    c.pauseLength = 0;
+    c.pauseLevel = -1;
+
+    int result = TAPE_BLOCK_END;
+    if (m_file != nullptr && c.block < m_size)
+    {
+        switch (m_format)
+        {
+            case TapeFormat::TAP: result = parseTAP(c, c.block); break;
+            case TapeFormat::TZX: result = parseTZX(c, c.block); break;
+            case TapeFormat::PZX: result = parsePZX(c, c.block); break;
+        }
+    }
+    if (result == TAPE_BLOCK_END)
+    {
+        c.stage = TAPE_STAGE_END;
+        return result;
+    }
+    c.index++;
+    return result;
+}
+
+int TapeStream::parseTAP(TapeCursor& c, int64_t offset)
+{
+    // Length of the block, 16 bits, then the flag, the data and the parity
+    if (offset + 2 > m_size) { return TAPE_BLOCK_END; }
+    uint32_t length = readWord(offset);
+    int64_t data = offset + 2;
+    c.block = data + length;
+    if (length > 0)
+    {
+        setupStandard(c, data, length, readByte(data), TAPE_TAP_PAUSE);
+    }
+    return TAPE_BLOCK_SIGNAL;
+}
+
+int TapeStream::parseTZX(TapeCursor& c, int64_t offset)
+{
+    uint8_t id = readByte(offset);
+    int64_t p = offset + 1;
+    switch (id)
+    {
+        case 0x10:  // Standard speed data
+        {
+            uint32_t length = readWord(p + 2);
+            c.block = p + 4 + length;
+            if (length > 0)
+            {
+                setupStandard(c, p + 4, length, readByte(p + 4), readWord(p));
+            }
+            else
+            {
+                c.pauseLength = readWord(p) * TAPE_MS_TSTATES;
+            }
+            return TAPE_BLOCK_SIGNAL;
+        }
+        case 0x11:  // Turbo speed data
+        {
+            uint32_t length = readTriple(p + 15);
+            c.block = p + 18 + length;
+            c.toneLength = readWord(p);
+            c.toneCount = readWord(p + 10);
+            c.sync[0] = readWord(p + 2);
+            c.sync[1] = readWord(p + 4);
+            c.syncCount = 2;
+            setupData(c, p + 18, length, readByte(p + 12), readWord(p + 6), readWord(p + 8));
+            c.pauseLength = readWord(p + 13) * TAPE_MS_TSTATES;
+            return TAPE_BLOCK_SIGNAL;
+        }
+        case 0x12:  // Pure tone
+            c.block = p + 4;
+            c.toneLength = readWord(p);
+            c.toneCount = readWord(p + 2);
+            return TAPE_BLOCK_SIGNAL;
+        case 0x13:  // Pulse sequence
+            c.pulses = p + 1;
+            c.pulsesEnd = c.pulses + 2 * readByte(p);
+            c.block = c.pulsesEnd;
+            return TAPE_BLOCK_SIGNAL;
+        case 0x14:  // Pure data
+        {
+            uint32_t length = readTriple(p + 7);
+            c.block = p + 10 + length;
+            setupData(c, p + 10, length, readByte(p + 4), readWord(p), readWord(p + 2));
+            c.pauseLength = readWord(p + 5) * TAPE_MS_TSTATES;
+            return TAPE_BLOCK_SIGNAL;
+        }
+        case 0x15:  // Direct recording
+        {
+            uint32_t length = readTriple(p + 5);
+            c.block = p + 8 + length;
+            setupData(c, p + 8, length, readByte(p + 4), 0, 0);
+            c.stage = TAPE_STAGE_DIRECT;
+            c.sampleLength = readWord(p);
+            c.pauseLength = readWord(p + 2) * TAPE_MS_TSTATES;
+            return TAPE_BLOCK_SIGNAL;
+        }
+        case 0x20:  // Pause, 0 stops the tape
+            c.block = p + 2;
+            c.pauseLength = readWord(p) * TAPE_MS_TSTATES;
+            return (c.pauseLength == 0) ? TAPE_BLOCK_STOP : TAPE_BLOCK_SIGNAL;
+        case 0x21:  // Group start
+            c.block = p + 1 + readByte(p);
+            return TAPE_BLOCK_SILENT;
+        case 0x22:  // Group end
+        case 0x25:  // Loop end
+        case 0x27:  // Return from sequence
+            c.block = p;
+            return (id == 0x25) ? TAPE_BLOCK_LOOP : TAPE_BLOCK_SILENT;
+        case 0x23:  // Jump, not followed
+            c.block = p + 2;
+            return TAPE_BLOCK_SILENT;
+        case 0x24:  // Loop start
+            c.block = p + 2;
+            c.loopStart = c.block;
+            c.loopCount = readWord(p);
+            return TAPE_BLOCK_SILENT;
+        case 0x26:  // Call sequence, not followed
+            c.block = p + 2 + 2 * readWord(p);
+            return TAPE_BLOCK_SILENT;
+        case 0x28:  // Select block
+        case 0x32:  // Archive info
+            c.block = p + 2 + readWord(p);
+            return TAPE_BLOCK_SILENT;
+        case 0x2B:  // Set signal level
+            c.block = p + 4 + readLong(p);
+            c.level = readByte(p + 4) & 1;
+            return TAPE_BLOCK_SILENT;
+        case 0x30:  // Text description
+            c.block = p + 1 + readByte(p);
+            return TAPE_BLOCK_SILENT;
+        case 0x31:  // Message
+            c.block = p + 2 + readByte(p + 1);
+            return TAPE_BLOCK_SILENT;
+        case 0x33:  // Hardware type
+            c.block = p + 1 + 3 * readByte(p);
+            return TAPE_BLOCK_SILENT;
+        case 0x34:  // Emulation info, fixed size
+            c.block = p + 8;
+            return TAPE_BLOCK_SILENT;
+        case 0x35:  // Custom info
+            c.block = p + 20 + readLong(p + 16);
+            return TAPE_BLOCK_SILENT;
+        case 0x5A:  // Glue of merged files
+            c.block = p + 9;
+            return TAPE_BLOCK_SILENT;
+        case 0x40:  // Snapshot, type and 24 bit length
+            c.block = p + 4 + readTriple(p + 1);
+            return TAPE_BLOCK_SILENT;
+        default:
+            // The other blocks start with their length (CSW and generalized
+            // data aren't played, stop the tape if 48K is ignored)
+            c.block = p + 4 + readLong(p);
+            return TAPE_BLOCK_SILENT;
+    }
+}
+
+int TapeStream::parsePZX(TapeCursor& c, int64_t offset)
+{
+    // Tag and size of the block, 32 bits
+    if (offset + 8 > m_size) { return TAPE_BLOCK_END; }
+    char tag[4];
+    for (int i = 0; i < 4; i++)
+    {
+        tag[i] = (char)readByte(offset + i);
+    }
+    int64_t p = offset + 8;
+    c.block = p + readLong(offset + 4);
+
+    if (memcmp(tag, "PULS", 4) == 0)
+    {
+        // The first pulse is low
+        c.stage = TAPE_STAGE_PULSES;
+        c.pulses = p;
+        c.pulsesEnd = c.block;
+        c.level = 1;
+        return TAPE_BLOCK_SIGNAL;
+    }
+    if (memcmp(tag, "DATA", 4) == 0)
+    {
+        uint32_t count = readLong(p);
+        uint32_t p0 = readByte(p + 6);
+        uint32_t p1 = readByte(p + 7);
+        c.stage = TAPE_STAGE_DATA;
+        c.level = (count >> 31) ^ 1;
+        c.dataBits = count & 0x7FFFFFFF;
+        c.tailLength = readWord(p + 4);
+        c.bitPulses[0] = p0;
+        c.bitPulses[1] = p1;
+        c.bitSequence[0] = p + 8;
+        c.bitSequence[1] = p + 8 + 2 * p0;
+        c.data = p + 8 + 2 * (p0 + p1);
+        c.bitMask = 0x80;
+        return TAPE_BLOCK_SIGNAL;
+    }
+    if (memcmp(tag, "PAUS", 4) == 0)
+    {
+        uint32_t pause = readLong(p);
+        c.stage = TAPE_STAGE_PAUSE;
+        c.pauseLength = pause & 0x7FFFFFFF;
+        c.pauseLevel = pause >> 31;
+        return TAPE_BLOCK_SIGNAL;
+    }
+    if (memcmp(tag, "STOP", 4) == 0)
+    {
+        return TAPE_BLOCK_STOP;
+    }
+    // PZXT header, BRWS browse points
+    return TAPE_BLOCK_SILENT;
+}
+
+uint32_t TapeStream::sequenceLength(const TapeCursor& c, uint32_t bit, uint32_t pulse)
+{
+    // The data follows the sequences, reading them through the file buffer
+    // would refill it with every bit of a long block
+    if (m_sequenceOffset[bit] != c.bitSequence[bit])
+    {
+        m_sequenceOffset[bit] = c.bitSequence[bit];
+        m_sequence[bit].resize(c.bitPulses[bit]);
+        for (uint32_t i = 0; i < c.bitPulses[bit]; i++)
+        {
+            m_sequence[bit][i] = (uint16_t)readWord(c.bitSequence[bit] + 2 * i);
+        }
+    }
+    return m_sequence[bit][pulse];
+}
+
+bool TapeStream::readBit(TapeCursor& c)
+{
+    bool bit = (readByte(c.data) & c.bitMask) != 0;
+    c.bitMask >>= 1;
+    if (c.bitMask == 0)
+    {
+        c.bitMask = 0x80;
+        c.data++;
+    }
+    c.dataBits--;
+    return bit;
+}
+
+uint8_t TapeStream::readByte(int64_t offset)
+{
+    if (offset < m_bufferStart || offset >= m_bufferStart + m_bufferSize)
+    {
+        // Past the end of the file reads as zero
+        if (m_file == nullptr || offset < 0 || offset >= m_size) { return 0; }
+        m_bufferStart = offset;
+        m_bufferSize = 0;
+        if (fseek(m_file, (long)offset, SEEK_SET) == 0)
+        {
+            m_bufferSize = (int64_t)fread(m_buffer.data(), 1, m_buffer.size(), m_file);
+        }
+        if (m_bufferSize == 0) { return 0; }
+    }
+    return m_buffer[(size_t)(offset - m_bufferStart)];
+}
+
+uint32_t TapeStream::readWord(int64_t offset)
+{
+    return readByte(offset) | (readByte(offset + 1) << 8);
+}
+
+uint32_t TapeStream::readTriple(int64_t offset)
+{
+    return readWord(offset) | (readByte(offset + 2) << 16);
+}
+
+uint32_t TapeStream::readLong(int64_t offset)
+{
+    return readWord(offset) | (readWord(offset + 2) << 16);
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <stdint.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#define TAPE_FILE_BUFFER 4096           // Bytes of the file held in memory
+#define TAPE_CLOCK 3500000              // Tape timings are T-states of a 3.5 MHz Z80
+#define TAPE_MS_TSTATES 3500            // T-states of TAPE_CLOCK in a millisecond
+#define TAPE_TAP_PAUSE 1000             // Milliseconds of silence after a TAP block
+
+// Stages of a block, played in this order, those without pulses are skipped
+#define TAPE_STAGE_BLOCK 0              // Read the next block header
+#define TAPE_STAGE_TONE 1               // Pilot or pure tone, pulses of one length
+#define TAPE_STAGE_SYNC 2               // Sync pulses of the standard and turbo blocks
+#define TAPE_STAGE_PULSES 3             // Pulse lengths listed in the file
+#define TAPE_STAGE_DATA 4               // Bits, each a sequence of pulses
+#define TAPE_STAGE_DIRECT 5             // Bits are the levels of equal samples
+#define TAPE_STAGE_TAIL 6               // Pulse after the data (PZX)
+#define TAPE_STAGE_PAUSE 7              // Silence after the block
+#define TAPE_STAGE_END 8
+
+enum class TapeFormat { TAP, TZX, PZX };
+
+// Signal of the tape between two edges
+struct TapePulse {
+    uint32_t length;                    // T-states, may be 0
+    int level;
+};
+
+// Position in the signal of the tape, plain data so that it can be copied
+// into machine snapshots. Offsets are relative to the start of the file
+struct TapeCursor {
+    int64_t block;                      // Header of the next block
+    int64_t pulses;                     // Next pulse length of a pulse list
+    int64_t pulsesEnd;
+    int64_t data;                       // Byte with the next bit
+    int64_t bitSequence[2];             // PZX: pulse lengths of the 0 and 1 bits
+    int64_t loopStart;
+
+    int32_t index;                      // Blocks started
+    int32_t stage;
+    int32_t level;                      // Level of the last pulse
+    int32_t standard;                   // Block is a standard speed data block
+    uint32_t toneLength;
+    uint32_t toneCount;
+    uint32_t sync[2];
+    uint32_t syncCount;
+    uint32_t repeat;                    // PZX: repeats of repeatLength left
+    uint32_t repeatLength;
+    uint32_t dataBits;                  // Bits left
+    uint32_t bitMask;                   // Next bit of the byte at data
+    uint32_t bit;                       // Bit played
+    uint32_t bitPulse;                  // Its pulses played
+    uint32_t bitPulses[2];              // Pulses of a 0 and a 1 bit
+    uint32_t bitLength[2];              // TZX: length of the pulses of a bit
+    uint32_t sampleLength;              // Direct recording: T-states per bit
+    uint32_t tailLength;
+    uint32_t pauseLength;               // T-states of silence
+    int32_t pauseLevel;                 // -1: TZX pause, an edge and then low
+    uint32_t loopCount;
+};
+
+// Reads the signal of a TAP, TZX or PZX file as a stream of pulses. The
+// blocks are decoded when the signal reaches them and the file is read
+// through a small buffer, memory use doesn't depend on the tape length
+class TapeStream {
+    public:
+        TapeStream();
+        ~TapeStream();
+        TapeStream(const TapeStream&) = delete;
+        TapeStream& operator=(const TapeStream&) = delete;
+
+        // The format is told by the header, files without one are TAP
+        bool open(std::string filename);
+        void close();
+        bool isOpen();
+        TapeFormat getFormat();
+
+        void rewind();
+        // Next pulse of the signal, false when the tape stops (TZX pause
+        // of 0 ms, PZX STOP) or ends. The level is 0 or 1
+        bool next(TapePulse& pulse);
+        bool isAtEnd();
+
+        // Standard speed data block at the cursor, blocks without signal
+        // before it are skipped. Reads its bytes and moves past it, if there
+        // is none the cursor stays. A block played partly is skipped
+        bool readStandardBlock(std::vector<uint8_t>& data);
+        bool hasStandardBlock();
+
+        int getBlockCount();
+        int getCurrentBlock();
+
+        const TapeCursor& getCursor();
+        void setCursor(const TapeCursor& cursor);
+    private:
+        // Set up the stages of the block at m_cursor.block
+        int parseBlock(TapeCursor& c);
+        int parseTAP(TapeCursor& c, int64_t offset);
+        int parseTZX(TapeCursor& c, int64_t offset);
+        int parsePZX(TapeCursor& c, int64_t offset);
+        // Cursor at the next standard speed block, false if there is none
+        bool findStandardBlock(TapeCursor& c);
+
+        uint8_t readByte(int64_t offset);
+        uint32_t readWord(int64_t offset);
+        uint32_t readTriple(int64_t offset);
+        uint32_t readLong(int64_t offset);
+        bool readBit(TapeCursor& c);
+        // Length of a pulse of a PZX bit
+        uint32_t sequenceLength(const TapeCursor& c, uint32_t bit, uint32_t pulse);
+
+        FILE* m_file;
+        TapeFormat m_format;
+        int64_t m_size;
+        int64_t m_firstBlock;
+        int m_blockCount;
+        TapeCursor m_cursor;
+
+        std::vector<uint8_t> m_buffer;
+        int64_t m_bufferStart;
+        int64_t m_bufferSize;
+
+        // Pulse lengths of the 0 and 1 bits of the PZX block played
+        std::vector<uint16_t> m_sequence[2];
+        int64_t m_sequenceOffset[2];
+};
@@ -0,0 +1,259 @@
+
+#include "frame_tests.h"
+#include "../png.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+
+static const uint64_t HASH_PRIME1 = 11400714785074694791ULL;
+static const uint64_t HASH_PRIME2 = 14029467366897019727ULL;
+static const uint64_t HASH_PRIME3 = 1609587929392839161ULL;
+
+static inline uint64_t rotateLeft(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t hashRound(uint64_t lane, uint64_t input)
+{
+    return rotateLeft(lane + input * HASH_PRIME2, 31) * HASH_PRIME1;
+}
+
+uint64_t hashFrameData(const void* data, size_t size)
+{
+    const uint8_t* p = (const uint8_t*)data;
+    uint64_t lanes[4] = { HASH_PRIME1 + HASH_PRIME2, HASH_PRIME2, 0, 0 - HASH_PRIME1 };
+
+    for (size_t blocks = size / 32; blocks > 0; blocks--, p += 32)
+    {
+        uint64_t values[4];
+        memcpy(values, p, 32);
+        for (int i = 0; i < 4; i++)
+        {
+            lanes[i] = hashRound(lanes[i], values[i]);
+        }
+    }
+
+    uint64_t hash = rotateLeft(lanes[0], 1) + rotateLeft(lanes[1], 7)
+        + rotateLeft(lanes[2], 12) + rotateLeft(lanes[3], 18) + size;
+    for (size_t rest = size % 32; rest > 0; rest--, p++)
+    {
+        hash = rotateLeft(hash ^ (*p * HASH_PRIME3), 11) * HASH_PRIME1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= HASH_PRIME2;
+    hash ^= hash >> 29;
+    hash *= HASH_PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+static bool findKey(const std::string& name, SDL_Keycode& key)
+{
+    for (int i = 0; i < 8; i++)
+    for (int j = 0; j < 5; j++)
+    {
+        if (Keyboard::keyStrings[i][j] == name)
+        {
+            key = Keyboard::codes[i][j];
+            return true;
+        }
+    }
+    return false;
+}
+
+bool FrameTester::parseTestFile(std::string file)
+{
+    std::ifstream inStream;
+    inStream.open(file, std::ios::in);
+    if (!inStream.is_open())
+    {
+        std::cerr << "Frame test file failed to open" << std::endl;
+        return false;
+    }
+
+    FrameTestCase test;
+    bool inTest = false;
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(inStream, line))
+    {
+        lineNumber++;
+        if (!parseLine(line, test, inTest))
+        {
+            std::cerr << file << ":" << lineNumber << ": invalid frame test line '" << line << "'" << std::endl;
+            return false;
+        }
+    }
+    if (inTest)
+    {
+        std::cerr << file << ": frame test '" << test.name << "' has no end" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool FrameTester::parseLine(const std::string& line, FrameTestCase& test, bool& inTest)
+{
+    std::stringstream stream(line);
+    std::string command;
+    if (!(stream >> command) || command[0] == '#') { return true; }
+
+    if (command == "test")
+    {
+        test = FrameTestCase();
+        test.machine = MachineType::SPECTRUM_48K;
+        inTest = true;
+        return (bool)(stream >> test.name);
+    }
+    if (!inTest) { return false; }
+
+    if (command == "machine")
+    {
+        std::string machine;
+        stream >> machine;
+        if (machine != "48" && machine != "128") { return false; }
+        test.machine = (machine == "128") ? MachineType::SPECTRUM_128K : MachineType::SPECTRUM_48K;
+        return true;
+    }
+    if (command == "rom")
+    {
+        return (bool)(stream >> test.rom);
+    }
+    if (command == "tape")
+    {
+        return (bool)(stream >> test.tape);
+    }
+    if (command == "key")
+    {
+        FrameKeyEvent event;
+        std::string name, state;
+        if (!(stream >> event.frame >> name >> state) || event.frame < 0 || !findKey(name, event.key)) { return false; }
+        if (state != "down" && state != "up") { return false; }
+        event.pressed = (state == "down");
+        test.keys.push_back(event);
+        return true;
+    }
+    if (command == "check")
+    {
+        FrameCheck check;
+        std::string type, hash;
+        if (!(stream >> check.frame >> type) || check.frame < 0) { return false; }
+        if (type != "screen" && type != "frame") { return false; }
+        check.type = (type == "screen") ? FrameCheckType::SCREEN : FrameCheckType::FRAME;
+        check.hasHash = (bool)(stream >> hash);
+        check.hash = 0;
+        if (check.hasHash)
+        {
+            // The whole token is the hash, up to 16 hex digits
+            std::istringstream hashStream(hash);
+            if (hash.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos ||
+                !(hashStream >> std::hex >> check.hash) || !hashStream.eof())
+            {
+                return false;
+            }
+        }
+        test.checks.push_back(check);
+        return true;
+    }
+    if (command == "end")
+    {
+        m_testCases.push_back(test);
+        inTest = false;
+        return true;
+    }
+    return false;
+}
+
+int FrameTester::runTests()
+{
+    int failed = 0;
+    for (const FrameTestCase& test : m_testCases)
+    {
+        failed += runTest(test);
+    }
+    std::cerr << "Frame tests: " << m_testCases.size() << " tests, " << failed << " failed checks" << std::endl;
+    return failed;
+}
+
+int FrameTester::runTest(const FrameTestCase& test)
+{
+    std::vector<FrameKeyEvent> keys = test.keys;
+    std::vector<FrameCheck> checks = test.checks;
+    auto byFrame = [](const auto& a, const auto& b) { return a.frame < b.frame; };
+    std::stable_sort(keys.begin(), keys.end(), byFrame);
+    std::stable_sort(checks.begin(), checks.end(), byFrame);
+    if (checks.empty()) { return 0; }
+
+    Emulator emu(nullptr);
+    emu.setMachineType(test.machine);
+    emu.loadROM(test.rom.empty() ? getMachineModel(test.machine).defaultROM : test.rom);
+    if (!test.tape.empty() && !emu.getTape()->insert(test.tape))
+    {
+        return (int)test.checks.size();
+    }
+    ULA* ula = emu.getULA();
+    VideoFrame frame;
+
+    int failed = 0;
+    size_t nextKey = 0;
+    size_t nextCheck = 0;
+    for (int frameNumber = 0; nextCheck < checks.size(); frameNumber++)
+    {
+        // Checkpoints see the state after frameNumber frames
+        for (; nextCheck < checks.size() && checks[nextCheck].frame == frameNumber; nextCheck++)
+        {
+            const FrameCheck& check = checks[nextCheck];
+            uint64_t hash;
+            if (check.type == FrameCheckType::FRAME)
+            {
+                hash = hashFrameData(ula->renderFrame(), FRAME_WIDTH * FRAME_HEIGHT * sizeof(uint32_t));
+            }
+            else
+            {
+                ula->copyFrame(frame);
+                hash = hashFrameData(frame.screen, SCREEN_SIZE);
+            }
+
+            std::stringstream hex;
+            hex << std::hex << std::setw(16) << std::setfill('0') << hash;
+            const char* type = (check.type == FrameCheckType::FRAME) ? "frame" : "screen";
+            if (!check.hasHash)
+            {
+                std::cerr << "Frame test '" << test.name << "': check " << frameNumber << " " << type
+                    << " " << hex.str() << std::endl;
+                continue;
+            }
+            if (hash == check.hash) { continue; }
+
+            failed++;
+            std::stringstream filename;
+            filename << test.name << "_" << frameNumber << ".png";
+            std::cerr << "Error running frame test '" << test.name << "', " << type << " at frame "
+                << frameNumber << " is " << hex.str() << ", saved as " << filename.str() << std::endl;
+
+            const uint32_t* pixels = ula->renderFrame();
+            std::vector<uint8_t> rgb;
+            for (int i = 0; i < FRAME_WIDTH * FRAME_HEIGHT; i++)
+            {
+                rgb.push_back((uint8_t)(pixels[i] >> 16));
+                rgb.push_back((uint8_t)(pixels[i] >> 8));
+                rgb.push_back((uint8_t)pixels[i]);
+            }
+            writePNG(filename.str(), rgb.data(), FRAME_WIDTH, FRAME_HEIGHT);
+        }
+
+        // Input is read by the machine at the start of the next frame
+        for (; nextKey < keys.size() && keys[nextKey].frame == frameNumber; nextKey++)
+        {
+            emu.setKey(keys[nextKey].key, keys[nextKey].pressed);
+        }
+        if (nextCheck < checks.size())
+        {
+            emu.runHeadless(1);
+        }
+    }
+    return failed;
+}
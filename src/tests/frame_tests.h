@@ -0,0 +1,68 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+
+#include "../emulator.h"
+
+// Golden frame tests, each runs the machine headless with scripted input
+// and compares hashes of the frame at checkpoints. Test file format, one
+// command per line, frames are counted from the reset:
+//
+//   test <name>
+//   machine 48|128
+//   rom <file>
+//   tape <file>                    TAP, TZX or PZX inserted at the reset, LOAD "" typed with keys
+//   key <frame> <key> down|up      key as in Keyboard::keyStrings (ZX_ENTER)
+//   check <frame> frame|screen [hash]
+//   end
+//
+// "frame" hashes the pixels with the border, "screen" the raw 6912 bytes of
+// the displayed screen memory. A check without a hash prints the current
+// one, so new golden values can be recorded. A differing frame is saved
+// as <name>_<frame>.png
+enum class FrameCheckType {
+    FRAME,
+    SCREEN
+};
+
+struct FrameCheck {
+    int frame;
+    FrameCheckType type;
+    bool hasHash;
+    uint64_t hash;
+};
+
+struct FrameKeyEvent {
+    int frame;
+    SDL_Keycode key;
+    bool pressed;
+};
+
+struct FrameTestCase {
+    std::string name;
+    MachineType machine;
+    std::string rom;
+    std::string tape;
+    std::vector<FrameKeyEvent> keys;
+    std::vector<FrameCheck> checks;
+};
+
+// 64-bit hash of a buffer, four independent lanes so that the multiplies
+// of consecutive blocks overlap
+uint64_t hashFrameData(const void* data, size_t size);
+
+class FrameTester {
+    public:
+        bool parseTestFile(std::string file);
+        // Returns the number of failed checks
+        int runTests();
+    protected:
+        bool parseLine(const std::string& line, FrameTestCase& test, bool& inTest);
+        int runTest(const FrameTestCase& test);
+    private:
+        std::vector<FrameTestCase> m_testCases;
+};
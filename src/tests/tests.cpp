@@ -13,7 +13,7 @@ void _test(T correct, T input, char* file, int line)
     }
 }
 
-void runTests(Z80& proc, Spectrum48KMemory& memory)
+void runTests(Z80& proc, SpectrumMemory& memory)
 {
     proc.getRegisters()->AF.bytes.low.CF = false;
 
@@ -16,6 +16,6 @@ void _test(T correct, T input, char* file, int line);
 
 // Simple instruction tests
 // May need to use a proper unit testing framework in the future
-void runTests(Z80& proc, Spectrum48KMemory& memory);
+void runTests(Z80& proc, SpectrumMemory& memory);
 
 #endif
\ No newline at end of file
@@ -154,7 +154,8 @@ void Z80Tester::runTests()
 {
     Debugger d;
     ULA ula;
-    Spectrum48KMemory memory;
+    SpectrumMemory memory;
+    memory.setROMWriteProtect(false);
     Z80 z80(&memory, &ula, &d);
 
     for (auto test : m_testCases)
@@ -198,7 +199,7 @@ void Z80Tester::runTests()
 
         for (auto record : test.inMemory)
         {
-            memory.memory[record.first] = record.second;
+            memory.poke(record.first, record.second);
         }
 
         while (z80.m_cyclesSinceLastFrame < test.inTStates)
@@ -262,6 +263,6 @@ void Z80Tester::compareResults(Z80TestCase &test, Z80* z80)
         std::stringstream stream;
         stream << std::hex << record.first;
         std::string s = "Memory location " + stream.str();
-        assertEqual(z80->m_memory->memory[record.first], record.second, test, s);
+        assertEqual(z80->m_memory->peek(record.first), record.second, test, s);
     }
 }
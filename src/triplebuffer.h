@@ -0,0 +1,44 @@
+#pragma once
+
+#include <atomic>
+
+// Hands values over from one producer thread to one consumer thread without
+// locking. The producer fills back() and publishes it, the consumer acquires
+// the latest published value into front(). Neither side ever waits, values
+// the consumer did not pick up in time are overwritten
+template<typename T>
+class TripleBuffer {
+    public:
+        TripleBuffer()
+            : m_back(0),
+              m_middle(1),
+              m_front(2)
+        {}
+        TripleBuffer(const TripleBuffer&) = delete;
+        TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+        // Producer side
+        T& back() { return m_buffers[m_back]; }
+        void publish()
+        {
+            m_back = m_middle.exchange(m_back | FRESH, std::memory_order_acq_rel) & INDEX;
+        }
+
+        // Consumer side, returns false if nothing was published since the last call
+        bool acquire()
+        {
+            if ((m_middle.load(std::memory_order_relaxed) & FRESH) == 0) { return false; }
+            m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & INDEX;
+            return true;
+        }
+        const T& front() const { return m_buffers[m_front]; }
+    private:
+        // The middle index carries a flag telling that it holds a new value
+        static const int INDEX = 0x03;
+        static const int FRESH = 0x04;
+
+        T m_buffers[3];
+        int m_back;
+        std::atomic<int> m_middle;
+        int m_front;
+};
@@ -1,3 +1,342 @@
-
 #include "ula.h"
+#include "z80.h"
+
+#include <algorithm>
+
+#define FLASH_FRAMES 16
+
+ULA::ULA()
+    : m_cpu(nullptr),
+      m_memory(nullptr),
+      m_frame(FRAME_WIDTH * FRAME_HEIGHT, 0xFF000000),
+      m_frameVersion(0),
+      m_position(0),
+      m_mixed(true),
+      m_rendering(true),
+      m_skipping(false),
+      m_border(7),
+      m_borderChanged(true),
+      m_flashInverted(false),
+      m_flashFrames(0)
+{
+    setMachineModel(getMachineModel(MachineType::SPECTRUM_48K));
+}
+
+void ULA::attach(Z80* cpu, SpectrumMemory* memory)
+{
+    m_cpu = cpu;
+    m_memory = memory;
+    m_memory->setScreenListener(this);
+}
+
+void ULA::setMachineModel(const MachineModel& model)
+{
+    m_tStatesPerLine = model.tStatesPerLine;
+    m_firstDisplayLine = model.firstDisplayLine;
+    m_frameStart = (m_firstDisplayLine - BORDER_TOP) * m_tStatesPerLine
+        - (BORDER_LEFT / 8) * FRAME_COLUMN_TSTATES;
+    m_mixed = true;
+}
+
+void ULA::receiveData(uint8_t data, uint16_t port, int tState)
+{
+    if ((port & 0x01) != 0) { return; }
+
+    uint8_t border = data & 0x07;
+    if (border != m_border)
+    {
+        catchUp(tState);
+        m_border = border;
+        m_borderChanged = true;
+    }
+}
+
+bool ULA::sendData(uint8_t& out, uint16_t port, int tState)
+{
+    return false;
+}
+
+void ULA::saveState(std::vector<uint8_t>& out)
+{
+    out.push_back(m_border);
+    out.push_back(m_flashInverted ? 1 : 0);
+    out.push_back((uint8_t)m_flashFrames);
+}
+
+void ULA::loadState(const uint8_t*& in)
+{
+    m_border = *in++;
+    m_flashInverted = *in++ != 0;
+    m_flashFrames = *in++;
+    m_borderChanged = true;
+    m_mixed = true;
+}
+
+void ULA::screenChanging(int offset)
+{
+    // Memory the beam has not reached yet is drawn with the new contents anyway
+    if (m_cpu == nullptr) { return; }
+    int tState = m_cpu->getFrameTStates();
+    if (offset >= 0 && tState < readTime(offset)) { return; }
+    catchUp(tState);
+}
+
+void ULA::endFrame()
+{
+    if (m_skipping)
+    {
+        // Changes stay in the dirty map and the border flag
+    }
+    else if (m_rendering && (m_position > 0 || m_mixed))
+    {
+        // The frame was changed while being drawn, finish it
+        renderColumns(m_position, FRAME_SIZE_COLUMNS);
+        m_memory->getScreenDirtyMap()->clear();
+        m_borderChanged = false;
+        m_mixed = (m_position > 0);
+        m_frameVersion++;
+    }
+    else
+    {
+        update();
+    }
+    m_position = 0;
+
+    m_flashFrames++;
+    if (m_flashFrames >= FLASH_FRAMES)
+    {
+        m_flashFrames = 0;
+        m_flashInverted = !m_flashInverted;
+
+        // Only the cells with FLASH attribute change
+        uint8_t* const* screen = m_memory->getScreenPages();
+        ScreenDirtyMap* dirty = m_memory->getScreenDirtyMap();
+        for (int cell = 0; cell < SCREEN_CELLS; cell++)
+        {
+            uint16_t memCol = SCREEN_BITMAP_SIZE + cell;
+            if (screen[memCol >> MEMORY_PAGE_SHIFT][memCol & MEMORY_PAGE_MASK] & 0x80)
+            {
+                dirty->markCell(cell);
+            }
+        }
+    }
+}
+
+void ULA::update()
+{
+    if (!m_rendering)
+    {
+        ScreenDirtyMap* dirty = m_memory->getScreenDirtyMap();
+        if (m_borderChanged || dirty->any)
+        {
+            dirty->clear();
+            m_borderChanged = false;
+            m_frameVersion++;
+        }
+        return;
+    }
+    if (m_mixed)
+    {
+        renderColumns(0, FRAME_SIZE_COLUMNS);
+        m_memory->getScreenDirtyMap()->clear();
+        m_borderChanged = false;
+        m_mixed = false;
+        m_frameVersion++;
+        return;
+    }
+
+    bool changed = false;
+    if (m_borderChanged)
+    {
+        renderBorder();
+        m_borderChanged = false;
+        changed = true;
+    }
+    if (m_memory->getScreenDirtyMap()->any)
+    {
+        renderDirtyCells();
+        changed = true;
+    }
+    if (changed)
+    {
+        m_frameVersion++;
+    }
+}
+
+void ULA::setRendering(bool rendering)
+{
+    m_rendering = rendering;
+    m_mixed = true;
+    m_position = 0;
+
+    // The display needs a frame in the new format even if nothing changes
+    m_frameVersion++;
+}
+
+bool ULA::isRendering()
+{
+    return m_rendering;
+}
+
+bool ULA::isFlashInverted()
+{
+    return m_flashInverted;
+}
+
+void ULA::setSkipping(bool skipping)
+{
+    m_skipping = skipping;
+}
+
+const uint32_t* ULA::getFrame()
+{
+    return m_frame.data();
+}
+
+int ULA::getFrameVersion()
+{
+    return m_frameVersion;
+}
+
+void ULA::copyFrame(VideoFrame& frame)
+{
+    frame.hasPixels = m_rendering;
+    if (m_rendering)
+    {
+        frame.pixels.assign(m_frame.begin(), m_frame.end());
+    }
+    uint8_t* const* screen = m_memory->getScreenPages();
+    for (int offset = 0; offset < SCREEN_SIZE; offset += MEMORY_PAGE_SIZE)
+    {
+        int size = std::min(MEMORY_PAGE_SIZE, SCREEN_SIZE - offset);
+        std::copy(screen[offset >> MEMORY_PAGE_SHIFT], screen[offset >> MEMORY_PAGE_SHIFT] + size,
+            frame.screen + offset);
+    }
+    frame.border = m_border;
+    frame.flashInverted = m_flashInverted;
+    frame.version = m_frameVersion;
+}
+
+const uint32_t* ULA::renderFrame()
+{
+    if (!m_rendering || m_skipping)
+    {
+        renderColumns(0, FRAME_SIZE_COLUMNS);
+    }
+    return m_frame.data();
+}
+
+uint8_t ULA::getBorder()
+{
+    return m_border;
+}
+
+int ULA::beamPosition(int tStates)
+{
+    int elapsed = tStates - m_frameStart;
+    if (elapsed <= 0) { return 0; }
+
+    int line = elapsed / m_tStatesPerLine;
+    if (line >= FRAME_HEIGHT) { return FRAME_SIZE_COLUMNS; }
+
+    // Columns whose first pixel was already drawn, the rest of the line
+    // is horizontal retrace
+    int columns = (elapsed % m_tStatesPerLine + FRAME_COLUMN_TSTATES - 1) / FRAME_COLUMN_TSTATES;
+    return line * FRAME_COLUMNS + std::min(columns, FRAME_COLUMNS);
+}
+
+int ULA::readTime(int offset)
+{
+    int x = offset & 0x1F;
+    int y;
+    if (offset < SCREEN_BITMAP_SIZE)
+    {
+        // Bits 11-12 are the third of the screen, 8-10 the pixel line
+        // and 5-7 the character row
+        y = (((offset >> 11) & 0x03) << 6) | (((offset >> 5) & 0x07) << 3) | ((offset >> 8) & 0x07);
+    }
+    else
+    {
+        // Attributes are read first on the top line of the character row
+        y = ((offset - SCREEN_BITMAP_SIZE) >> 5) * 8;
+    }
+    return (m_firstDisplayLine + y) * m_tStatesPerLine + x * FRAME_COLUMN_TSTATES;
+}
+
+void ULA::catchUp(int tState)
+{
+    if (!m_rendering || m_skipping) { return; }
+    int target = beamPosition(tState);
+    if (target > m_position)
+    {
+        renderColumns(m_position, target);
+        m_position = target;
+    }
+}
+
+void ULA::renderColumns(int from, int to)
+{
+    uint8_t* const* screen = m_memory->getScreenPages();
+    uint32_t border = m_converter.getColor(m_border);
+
+    int column = from;
+    while (column < to)
+    {
+        int line = column / FRAME_COLUMNS;
+        int end = std::min(to, (line + 1) * FRAME_COLUMNS);
+        int y = line - BORDER_TOP;
+        bool paperLine = (y >= 0 && y < SCREEN_HEIGHT);
+
+        uint16_t memPos = paperLine ? m_converter.getLineOffset(y) : 0;
+        uint16_t memCol = SCREEN_BITMAP_SIZE + (paperLine ? (y >> 3) * (SCREEN_WIDTH / 8) : 0);
+        uint32_t* out = &m_frame[line * FRAME_WIDTH];
+        for (; column < end; column++)
+        {
+            int c = column - line * FRAME_COLUMNS;
+            int x = c - BORDER_LEFT / 8;
+            if (paperLine && x >= 0 && x < SCREEN_WIDTH / 8)
+            {
+                uint16_t pos = memPos | x;
+                uint16_t col = memCol + x;
+                m_converter.expandByte(screen[pos >> MEMORY_PAGE_SHIFT][pos & MEMORY_PAGE_MASK],
+                    screen[col >> MEMORY_PAGE_SHIFT][col & MEMORY_PAGE_MASK],
+                    m_flashInverted, out + c * 8);
+            }
+            else
+            {
+                std::fill(out + c * 8, out + c * 8 + 8, border);
+            }
+        }
+    }
+}
+
+void ULA::renderBorder()
+{
+    uint32_t border = m_converter.getColor(m_border);
+    for (int line = 0; line < FRAME_HEIGHT; line++)
+    {
+        uint32_t* out = &m_frame[line * FRAME_WIDTH];
+        if (line < BORDER_TOP || line >= BORDER_TOP + SCREEN_HEIGHT)
+        {
+            std::fill(out, out + FRAME_WIDTH, border);
+            continue;
+        }
+        std::fill(out, out + BORDER_LEFT, border);
+        std::fill(out + BORDER_LEFT + SCREEN_WIDTH, out + FRAME_WIDTH, border);
+    }
+}
 
+void ULA::renderDirtyCells()
+{
+    uint8_t* const* screen = m_memory->getScreenPages();
+    ScreenDirtyMap* dirty = m_memory->getScreenDirtyMap();
+    uint32_t* paper = &m_frame[BORDER_TOP * FRAME_WIDTH + BORDER_LEFT];
+    for (int cell = 0; cell < SCREEN_CELLS; cell++)
+    {
+        if (dirty->isDirty(cell))
+        {
+            m_converter.convertCell(screen, cell, m_flashInverted, paper, FRAME_WIDTH);
+        }
+    }
+    dirty->clear();
+}
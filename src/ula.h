@@ -1,8 +1,112 @@
 #pragma once
 
-class ULA {
+#include "memory.h"
+#include "screen.h"
+#include "machine.h"
+#include "devices.h"
+
+#include <stdint.h>
+#include <vector>
+
+class Z80;
+
+// Visible frame with the border, in pixels
+#define FRAME_WIDTH 352
+#define FRAME_HEIGHT 296
+#define BORDER_LEFT ((FRAME_WIDTH - SCREEN_WIDTH) / 2)
+#define BORDER_TOP ((FRAME_HEIGHT - SCREEN_HEIGHT) / 2)
+
+// The frame is drawn in columns of 8 pixels, the ULA draws 2 pixels per T-state
+#define FRAME_COLUMNS (FRAME_WIDTH / 8)
+#define FRAME_COLUMN_TSTATES 4
+#define FRAME_SIZE_COLUMNS (FRAME_COLUMNS * FRAME_HEIGHT)
+
+// Finished frame, handed over from the emulation thread to the display
+struct VideoFrame {
+    std::vector<uint32_t> pixels;   // FRAME_WIDTH x FRAME_HEIGHT, if the ULA renders
+    bool hasPixels;
+    uint8_t screen[SCREEN_SIZE];    // Raw screen memory, for GPU decoding
+    uint8_t border;
+    bool flashInverted;
+    int version;
+
+    VideoFrame() : hasPixels(false), border(0), flashInverted(false), version(-1) {}
+};
+
+// Video part of the ULA. The frame is drawn at the end of the emulated frame,
+// unless the CPU changes the screen memory or the border behind the beam.
+// Then everything the beam has already passed is drawn first (catch-up), so
+// that it shows the state before the change
+class ULA : public IDevice, public ScreenListener {
     public:
-        // Process what happened in ULA since last instruction
-        void tick();
+        ULA();
+
+        void attach(Z80* cpu, SpectrumMemory* memory);
+        void setMachineModel(const MachineModel& model);
+
+        // Border color, port 0xFE
+        virtual void receiveData(uint8_t data, uint16_t port, int tState) override;
+        virtual bool sendData(uint8_t& out, uint16_t port, int tState) override;
+        virtual void saveState(std::vector<uint8_t>& out) override;
+        virtual void loadState(const uint8_t*& in) override;
+
+        virtual void screenChanging(int offset) override;
+
+        // Finish the frame that was just emulated
+        void endFrame();
+        // Redraw what changed without emulating (memory editor, snapshots)
+        void update();
+
+        // When the screen memory is decoded elsewhere (GPU), the frame is
+        // not drawn and the version only tracks changes of the screen memory
+        // and the border
+        void setRendering(bool rendering);
+        bool isRendering();
+        bool isFlashInverted();
+
+        // Frames emulated while skipping are not drawn, their changes are
+        // kept for the next drawn frame (turbo mode, slow hosts)
+        void setSkipping(bool skipping);
+
+        // FRAME_WIDTH x FRAME_HEIGHT pixels, see ScreenConverter
+        const uint32_t* getFrame();
+        // Incremented every time the frame changes
+        int getFrameVersion();
+        // Copy the current frame, reuses the memory of the previous contents
+        void copyFrame(VideoFrame& frame);
+        // Current frame in pixels, drawn from the screen memory first when
+        // the ULA is not rendering or skipping (captures in GPU_DECODE mode)
+        const uint32_t* renderFrame();
+        uint8_t getBorder();
     private:
-};
\ No newline at end of file
+        // Number of columns the beam has drawn at given T-state
+        int beamPosition(int tStates);
+        // T-state when the beam first reads given screen memory offset
+        int readTime(int offset);
+        // Draw the frame up to the beam position at tState
+        void catchUp(int tState);
+        void renderColumns(int from, int to);
+        void renderBorder();
+        void renderDirtyCells();
+
+        Z80* m_cpu;
+        SpectrumMemory* m_memory;
+        ScreenConverter m_converter;
+        std::vector<uint32_t> m_frame;
+        int m_frameVersion;
+
+        int m_tStatesPerLine;
+        int m_firstDisplayLine;
+        int m_frameStart;               // T-state of the top left frame pixel
+
+        int m_position;                 // Columns drawn in the current frame
+        bool m_mixed;                   // Frame shows several states, redraw all of it
+        bool m_rendering;
+        bool m_skipping;
+
+        uint8_t m_border;
+        bool m_borderChanged;
+
+        bool m_flashInverted;
+        int m_flashFrames;
+};
@@ -432,10 +432,77 @@ INT or(INT a, INT b, Z80Registers* r)
     return a;    
 }
 
+// Overloads for operands in memory, SpectrumMemory::operator[] returns
+// a MemoryCell instead of a reference to the byte
+
+inline bool hasEvenParity(MemoryCell x)
+{
+    return hasEvenParity<uint8_t>(x);
+}
+
+template <typename INT>
+INT rolc(MemoryCell val, bool carry)
+{
+    uint8_t byte = val;
+    INT carryOut = rolc<uint8_t>(byte, carry);
+    val = byte;
+    return carryOut;
+}
+
+template <typename INT>
+INT rorc(MemoryCell val, bool carry)
+{
+    uint8_t byte = val;
+    INT carryOut = rorc<uint8_t>(byte, carry);
+    val = byte;
+    return carryOut;
+}
+
+inline void sla(MemoryCell val, Z80Registers* r, bool sll = false)
+{
+    uint8_t byte = val;
+    sla<uint8_t>(byte, r, sll);
+    val = byte;
+}
+
+inline void sra(MemoryCell val, Z80Registers* r)
+{
+    uint8_t byte = val;
+    sra<uint8_t>(byte, r);
+    val = byte;
+}
+
+inline void srl(MemoryCell val, Z80Registers* r)
+{
+    uint8_t byte = val;
+    srl<uint8_t>(byte, r);
+    val = byte;
+}
+
+inline uint8_t add(uint8_t a, MemoryCell b, Z80Registers* r, uint8_t flags, bool useCarryIn = false, bool useBorrowIn = false)
+{
+    return add<uint8_t>(a, b, r, flags, useCarryIn, useBorrowIn);
+}
+
+inline uint8_t and(uint8_t a, MemoryCell b, Z80Registers* r)
+{
+    return and<uint8_t>(a, b, r);
+}
+
+inline uint8_t xor(uint8_t a, MemoryCell b, Z80Registers* r)
+{
+    return xor<uint8_t>(a, b, r);
+}
+
+inline uint8_t or(uint8_t a, MemoryCell b, Z80Registers* r)
+{
+    return or<uint8_t>(a, b, r);
+}
+
 enum class RetCondition { NZ = 0, Z, NC, C, PO, PE, P, M };
 
 // RET cc instructions
-inline void retc(Z80Registers* r, Spectrum48KMemory* m,  RetCondition c )
+inline void retc(Z80Registers* r, SpectrumMemory* m,  RetCondition c )
 {
     bool condition = false;
     switch (c)
@@ -462,7 +529,7 @@ inline void retc(Z80Registers* r, Spectrum48KMemory* m,  RetCondition c )
 }
 
 // CALL cc,nn instructinos
-inline void callc(Z80Registers* r, Spectrum48KMemory* m, RetCondition c, uint16_t nn)
+inline void callc(Z80Registers* r, SpectrumMemory* m, RetCondition c, uint16_t nn)
 {
     bool condition = false;
     switch (c)
@@ -1,6 +1,8 @@
 #include "z80.h"
 #include "debugger.h"
 
+#include <algorithm>
+
 int Z80::parseNextInstruction()
 {
     uint16_t location = m_registers.PC;
@@ -8,10 +10,10 @@ int Z80::parseNextInstruction()
 
     int i = 0;
     // Do not use memory's operator[] to circumvent memory contention emulation
-    while (prefixes.find(m_memory->memory[location]) != prefixes.end())
+    while (prefixes.find(m_memory->peek(location)) != prefixes.end())
     {
 
-        bytes.push_back((*m_memory)[location]);
+        bytes.push_back(m_memory->peek(location));
         location++;
         if (bytes.size() >= 2 && i > 0 && 
               ( (bytes[i-1] == 0xFD && bytes[i] == 0xDD) ||
@@ -43,7 +45,7 @@ int Z80::parseNextInstruction()
     if ( !(bytes.size() == 2 && (bytes[0] == 0xCB && bytes[1] == 0xDD)) )
     if ( !(bytes.size() == 2 && (bytes[0] == 0xCB && bytes[1] == 0xFD)) )
     {
-        bytes.push_back((*m_memory)[location]);
+        bytes.push_back(m_memory->peek(location));
         if ( bytes.size() > 1 && bytes[1] == 0xED ) { bytes[0] = 0; }     // Ignore other prefixes before ED
     }
     
@@ -93,18 +95,57 @@ void Z80::init()
     m_registers.DEx.word = 0xFFFF;
     m_registers.HLx.word = 0xFFFF;
 
+    m_isHalted = false;
+    m_isWaiting = false;
+    m_interruptMode = 0;
     m_cyclesSinceLastFrame = 0;
+    m_frameStart = 0;
+
+    // Devices schedule their events again when they are reset
+    m_scheduler.clear();
+    m_scheduler.schedule(0, m_eventListener, Z80_EVENT_INTERRUPT);
 
     m_instructionSet = z80InstructionSet();
 }
 
-Z80::Z80(Spectrum48KMemory* m, ULA* ula, Debugger* debugger)
+Z80::Z80(SpectrumMemory* m, ULA* ula, Debugger* debugger)
     : m_memory(m),
       m_ula(ula),
-      m_debugger(debugger)
+      m_debugger(debugger),
+      m_tStatesPerFrame(getMachineModel(MachineType::SPECTRUM_48K).tStatesPerFrame),
+      m_frameStart(0),
+      m_eventListener(m_scheduler.addListener(this)),
+      m_trapAddress(Z80_NO_TRAP),
+      m_trapHandler(nullptr)
 {
     init();
     m_cyclesSinceLastFrame = 0;
+    m_ioPorts.setDebugger(debugger);
+    m_ioPorts.setCPU(this);
+}
+
+void Z80::saveState(Z80State& state)
+{
+    state.registers = m_registers;
+    state.IFF1 = m_IFF1;
+    state.IFF2 = m_IFF2;
+    state.isHalted = m_isHalted;
+    state.isWaiting = m_isWaiting;
+    state.interruptMode = m_interruptMode;
+    state.cyclesSinceLastFrame = m_cyclesSinceLastFrame;
+    state.frameStart = m_frameStart;
+}
+
+void Z80::loadState(const Z80State& state)
+{
+    m_registers = state.registers;
+    m_IFF1 = state.IFF1;
+    m_IFF2 = state.IFF2;
+    m_isHalted = state.isHalted;
+    m_isWaiting = state.isWaiting;
+    m_interruptMode = state.interruptMode;
+    m_cyclesSinceLastFrame = state.cyclesSinceLastFrame;
+    m_frameStart = state.frameStart;
 }
 
 Z80Registers* Z80::getRegisters()
@@ -112,6 +153,11 @@ Z80Registers* Z80::getRegisters()
     return &m_registers;
 }
 
+Scheduler* Z80::getScheduler()
+{
+    return &m_scheduler;
+}
+
 Z80IOPorts* Z80::getIoPorts()
 {
     return &m_ioPorts;
@@ -158,7 +204,7 @@ std::vector<uint8_t> Z80::getInstructionData(Instruction inst, int instIndex, ui
     }
     for (; i < inst.numDataBytes; i++)
     {
-        data.push_back((*m_memory)[PC + i]);
+        data.push_back(m_memory->peek(PC + i));
     }
 
     return data;
@@ -228,10 +274,21 @@ void Z80::nextInstruction()
             }
         }
     }
+    if (m_registers.PC == m_trapAddress && m_trapHandler->onTrap(this))
+    {
+        m_cyclesSinceLastFrame += Z80_TRAP_TSTATES;
+        return;
+    }
+    uint16_t pc = m_registers.PC;
+    HEATMAP_EXECUTE(m_memory->getHeatmap(), pc);
     int instruction = parseNextInstruction();
     int numBytes = ( instruction >= 5*256 ) ? 3 : ( instruction >= 256 ) ? 2 : 1;
     m_registers.PC += numBytes;
     int cycles = runInstruction(instruction);
+    if (m_debugger->hasPendingWatchpointHits())
+    {
+        m_debugger->resolveWatchpointHits(pc, m_cyclesSinceLastFrame);
+    }
 
     if (m_debugger->shouldBreak())
     {
@@ -249,7 +306,7 @@ void Z80::nextInstruction()
         std::vector<uint8_t> opcodeBytes;
         for (int i = 0; i < numBytes; ++i)
         {
-            opcodeBytes.push_back((*m_memory)[m_registers.PC - inst.numDataBytes - numBytes + i]);
+            opcodeBytes.push_back(m_memory->peek(m_registers.PC - inst.numDataBytes - numBytes + i));
         }
         trace.opcodeBytes = opcodeBytes;
         m_debugger->addTrace(trace);
@@ -259,13 +316,44 @@ void Z80::nextInstruction()
 
 }
 
+void Z80::setTrap(int address, ITrapHandler* handler)
+{
+    m_trapAddress = (handler != nullptr) ? address : Z80_NO_TRAP;
+    m_trapHandler = handler;
+}
+
+void Z80::setTStatesPerFrame(int tStates)
+{
+    m_tStatesPerFrame = tStates;
+}
+
 void Z80::simulateFrame()
 {
-    while ( m_cyclesSinceLastFrame <= (1.0/50.0) / CLOCK_TIME )
+    // Events at the frame end, like the next interrupt, belong to the next
+    // frame. The inner loop only checks the time of the earliest event
+    int64_t frameEnd = m_frameStart + m_tStatesPerFrame;
+    m_scheduler.runDue(getTime());
+    while (getTime() < frameEnd)
     {
-        nextInstruction();
+        int next = (int)(std::min(m_scheduler.getNextTime(), frameEnd) - m_frameStart);
+        while (m_cyclesSinceLastFrame < next)
+        {
+            nextInstruction();
+        }
+        m_scheduler.runDue(std::min(getTime(), frameEnd - 1));
+    }
+    // The last instruction may run over to the next frame
+    m_frameStart = frameEnd;
+    m_cyclesSinceLastFrame -= m_tStatesPerFrame;
+}
+
+void Z80::onEvent(int id, int64_t tState)
+{
+    if (id == Z80_EVENT_INTERRUPT)
+    {
+        nmi();
+        m_scheduler.schedule(tState + m_tStatesPerFrame, m_eventListener, Z80_EVENT_INTERRUPT);
     }
-    m_cyclesSinceLastFrame = 0;
 }
 
 
@@ -286,10 +374,25 @@ void Z80::printState()
     std::cout << " DEx = " << m_registers.DEx.word << " HLx = " << m_registers.HLx.word;
     std::cout << " IX = " << m_registers.IX.word << " IY = " << m_registers.IY.word << std::endl;
 
-    std::cout << "(HL) = " << +(m_memory->memory[m_registers.HL.word]) << std::endl;
+    std::cout << "(HL) = " << +(m_memory->peek(m_registers.HL.word)) << std::endl;
 
 }
 
+Z80IOPorts::Z80IOPorts()
+    : m_debugger(nullptr),
+      m_cpu(nullptr)
+{}
+
+void Z80IOPorts::setDebugger(Debugger* debugger)
+{
+    m_debugger = debugger;
+}
+
+void Z80IOPorts::setCPU(Z80* cpu)
+{
+    m_cpu = cpu;
+}
+
 void Z80IOPorts::registerDevice(IDevice* device)
 {
     m_devices.push_back(device);
@@ -297,26 +400,53 @@ void Z80IOPorts::registerDevice(IDevice* device)
 
 void Z80IOPorts::writeToPort(uint16_t port, uint8_t value)
 {
+    int tState = (m_cpu != nullptr) ? m_cpu->getFrameTStates() : 0;
     for (IDevice* d : m_devices)
     {
-        d->receiveData(value, port);
+        d->receiveData(value, port, tState);
+    }
+    if (m_debugger && m_debugger->hasPortWatchpoints())
+    {
+        m_debugger->portWritten(port, value);
     }
 }
 
 uint8_t Z80IOPorts::readPort(uint16_t port)
 {
     uint8_t result = 0xFF;
+    int tState = (m_cpu != nullptr) ? m_cpu->getFrameTStates() : 0;
     for (IDevice* d : m_devices)
     {
         uint8_t data;
-        if (d->sendData(data, port))
+        if (d->sendData(data, port, tState))
         {
             result &= data;
         }
     }
+    if (m_debugger && m_debugger->hasPortWatchpoints())
+    {
+        m_debugger->portRead(port, result);
+    }
     return result;
 }
 
+void Z80IOPorts::saveState(std::vector<uint8_t>& out)
+{
+    out.clear();
+    for (IDevice* d : m_devices)
+    {
+        d->saveState(out);
+    }
+}
+
+void Z80IOPorts::loadState(const uint8_t*& in)
+{
+    for (IDevice* d : m_devices)
+    {
+        d->loadState(in);
+    }
+}
+
 void Z80::nmi()
 {
     if (!m_IFF1) { return; }
@@ -7,6 +7,7 @@
 #include "instructions.h"
 #include "devices.h"
 #include "ula.h"
+#include "scheduler.h"
 
 #define CREATE_WORD(L, H) (((uint16_t) L) | (((uint16_t) H) << 8))
 
@@ -22,6 +23,7 @@
 #include <memory>
 
 class Debugger;
+class Z80;
 
 typedef std::tuple<uint8_t, uint8_t, uint8_t> opcode;
 
@@ -114,24 +116,61 @@ struct Z80Registers {
     } HLx;
 };
 
+// Everything needed to resume execution, see Z80::saveState
+struct Z80State {
+    Z80Registers registers;
+    bool IFF1;
+    bool IFF2;
+    bool isHalted;
+    bool isWaiting;
+    int interruptMode;
+    int cyclesSinceLastFrame;
+    int64_t frameStart;
+};
+
 class Z80IOPorts {
     public:
+        Z80IOPorts();
         void registerDevice(IDevice* device);
 
+        // Reports accesses to watched ports
+        void setDebugger(Debugger* debugger);
+        // Clock for the time stamps of the accesses
+        void setCPU(Z80* cpu);
+
         void writeToPort(uint16_t port, uint8_t value);
         uint8_t readPort(uint16_t port);
 
+        // State of all registered devices, in registration order
+        void saveState(std::vector<uint8_t>& out);
+        void loadState(const uint8_t*& in);
+
     private:
         std::vector<IDevice*> m_devices;
+        Debugger* m_debugger;
+        Z80* m_cpu;
 };
 
-class Z80 {
+#define Z80_EVENT_INTERRUPT 0            // Maskable interrupt at the start of each frame
+#define Z80_NO_TRAP -1
+#define Z80_TRAP_TSTATES 10             // Charged for a trapped routine, the T-states of its RET
+
+// Runs a ROM routine natively when the CPU reaches its entry point. Returns
+// false to let the CPU execute the instruction there after all, otherwise
+// the handler has set the registers the routine returns with, PC included
+class ITrapHandler {
+    public:
+        virtual bool onTrap(Z80* cpu) = 0;
+};
+
+class Z80 : public IEventListener {
     friend class Z80Tester;
     public:
-        Z80(Spectrum48KMemory* m, ULA* ula, Debugger* debugger);
+        Z80(SpectrumMemory* m, ULA* ula, Debugger* debugger);
         void init();                    // Set power-on defaults
         Z80Registers* getRegisters();
         Z80IOPorts* getIoPorts();
+        Scheduler* getScheduler();
         void setIFF1(bool b);
         void setIFF2(bool b);
         bool getIFF2();
@@ -139,11 +178,29 @@ class Z80 {
         int getInterruptMode();
         void setInterruptMode(int m);
 
+        // Call the handler instead of executing the instruction at address,
+        // Z80_NO_TRAP removes it. There is one trap, for the tape loader
+        void setTrap(int address, ITrapHandler* handler);
+
+        // Frame length of the emulated machine, see MachineModel
+        void setTStatesPerFrame(int tStates);
+        // T-states since the interrupt at the start of the frame
+        inline int getFrameTStates() { return m_cyclesSinceLastFrame; }
+        // T-states since power on, the clock of the scheduler
+        inline int64_t getTime() { return m_frameStart + m_cyclesSinceLastFrame; }
+        inline int64_t getFrameStart() { return m_frameStart; }
+        // Run from the interrupt at the start of the frame up to the next
+        // one, dispatching the scheduled events on the way
         void simulateFrame();
 
+        virtual void onEvent(int id, int64_t tState) override;
+
         // Non-maskable interrupt
         void nmi();
 
+        void saveState(Z80State& state);
+        void loadState(const Z80State& state);
+
         void printState();
     protected:
         // Parse the next instruction from given memory location
@@ -154,7 +211,7 @@ class Z80 {
         void nextInstruction();
         int runInstruction(int instruction);
 
-        Spectrum48KMemory* m_memory;
+        SpectrumMemory* m_memory;
         ULA* m_ula;
         Debugger* m_debugger;
 
@@ -171,6 +228,14 @@ class Z80 {
         std::shared_ptr<std::array<Instruction, NUM_INSTRUCTIONS>> m_instructionSet;
 
         int m_cyclesSinceLastFrame;
+        int m_tStatesPerFrame;
+        int64_t m_frameStart;           // Absolute T-state of the frame start
+
+        Scheduler m_scheduler;
+        int m_eventListener;
+
+        int m_trapAddress;              // Z80_NO_TRAP or compared with PC before each instruction
+        ITrapHandler* m_trapHandler;
 };
 
 #endif
\ No newline at end of file